@@ -11,6 +11,8 @@ from matplotlib import cm
 parser = argparse.ArgumentParser()
 parser.add_argument("nocpath", help="path to noc debug info. Path should end in .noc.")
 parser.add_argument("--animate", help="path to output log file for animating noc diagram", default="")
+parser.add_argument("--metric", help="per-link counter to color by. Stall and occupancy counters are only in router_stats files",
+                    choices=["flits", "va_stall", "sa_stall", "occupancy"], default="flits")
 args = parser.parse_args()
 
 def get_file(ext):
@@ -62,10 +64,35 @@ for e in G.edges:
     edge_offsets[e] = str(offset)
     edge_indices[t] += 1
 
+# Each metric's record keyword and column. Occupancy records are per
+# virtual channel, and are summed per link
+metric_records = {
+    "flits": ("nocsample", 4),
+    "va_stall": ("nocstall", 4),
+    "sa_stall": ("nocstall", 5),
+    "occupancy": ("nococcupancy", 5),
+}
+
 if args.animate:
-    trace = open(sys.argv[2]).read().splitlines()
-    trace = list(filter(lambda x: "nocsample" in x, trace))
-    trace = {(int(t), e0, e1): int(n) for _, t, e0, e1, n in [l.split() for l in trace]}
+    keyword, column = metric_records[args.metric]
+    trace = open(args.animate).read().splitlines()
+    trace = [l.split() for l in trace if keyword in l]
+    counts = dict()
+    for l in trace:
+        k = (int(l[1]), l[2], l[3])
+        if args.metric == "occupancy":
+            counts[k] = counts.get(k, dict())
+            counts[k][l[4]] = int(l[column])
+        else:
+            counts[k] = int(l[column])
+    if args.metric == "occupancy":
+        # A virtual channel missing from a record is unchanged since the previous one
+        last = dict()
+        for k in sorted(counts.keys()):
+            e = (k[1], k[2])
+            last[e] = {**last.get(e, dict()), **counts[k]}
+            counts[k] = sum(last[e].values())
+    trace = counts
     timestamps = {0:{e:0 for e in G.edges}}
     for k, e0, e1 in trace:
         if k not in timestamps:
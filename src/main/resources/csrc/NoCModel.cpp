@@ -0,0 +1,674 @@
+/*
+ * Cycle-approximate software model of a generated NoC, which drives the
+ * traffic models of TrafficEval.cpp without an RTL simulator. The network
+ * is read from the debug artefacts emitted at elaboration:
+ *
+ *  <prefix>adjlist    routers, channels, ingresses and egresses
+ *  <prefix>edgeprops  buffer depth of each virtual channel of each channel
+ *  <prefix>routes     legal output virtual channels of each flow at each
+ *                     input virtual channel, from the routing relation
+ *
+ * Routers use credit-based wormhole flow control. A head flit at the front
+ * of an input virtual channel allocates a free output virtual channel
+ * among those its route allows, which the packet holds until its tail
+ * departs. Each cycle, each router forwards at most one flit per input
+ * port and per output port.
+ *
+ * Usage: noc_model [options] <noceval.cfg> <path/to/name.noc.>
+ *   --router-latency N   cycles from a flit's arrival at a router to its departure (2)
+ *   --link-latency N     cycles of every channel and of the credit return (1)
+ *   --terminal-buffer N  flits buffered at each ingress and egress (4)
+ *
+ * Under the checkpoint_save and checkpoint_restore directives of the
+ * config, the state of the network is saved and restored along with the
+ * traffic, in <file>.noc.
+ *
+ * Under the router_stats directive, the model reports the same per-link
+ * counters as the routers' debug signals. A head flit waiting for an
+ * output virtual channel counts as a VC allocation stall, and a flit
+ * waiting for its output port or for credits as a switch allocation stall.
+ */
+
+#include "TrafficEval.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+typedef struct model_flit_t {
+  flit_t flit;
+  // First cycle at which the flit may leave its buffer
+  uint64_t ready_cycle;
+} model_flit_t;
+
+typedef struct credit_return_t {
+  uint64_t cycle;
+  uint64_t* credits;
+} credit_return_t;
+
+typedef struct output_vc_t {
+  uint64_t credits;
+  bool allocated;
+} output_vc_t;
+
+typedef struct output_port_t {
+  // Downstream router and its input port, or the egress
+  int64_t dest_node;
+  uint64_t dest_port;
+  int64_t egress_id;
+  std::vector<output_vc_t> vcs;
+  // Index of the egress link in the router stats
+  uint64_t stats_link;
+} output_port_t;
+
+typedef struct input_vc_t {
+  ring_queue_t<model_flit_t> buffer;
+  // Credit counter of the upstream sender for this buffer
+  uint64_t* upstream_credits;
+  // Output port and virtual channel held by the packet at the front
+  int64_t out_port;
+  uint64_t out_vc;
+  // Candidate (output port, output virtual channel) pairs of each flow
+  std::unordered_map<uint64_t, std::vector<std::pair<uint64_t, uint64_t>>> routes;
+} input_vc_t;
+
+typedef struct input_port_t {
+  std::string name;
+  std::vector<input_vc_t> vcs;
+  uint64_t rr;
+  // Index of the link, and of its first virtual channel, in the router stats
+  uint64_t stats_link;
+  uint64_t stats_vc;
+} input_port_t;
+
+typedef struct router_t {
+  bool present;
+  std::vector<input_port_t> inputs;
+  std::vector<output_port_t> outputs;
+  // Input port names, as they appear in the routes file
+  std::map<std::string, uint64_t> input_ids;
+  std::map<uint64_t, uint64_t> output_ids;
+  std::map<uint64_t, uint64_t> egress_ports;
+} router_t;
+
+class noc_model_t
+{
+public:
+  noc_model_t(uint64_t router_latency, uint64_t link_latency, uint64_t terminal_buffer)
+    : router_latency(router_latency), link_latency(link_latency), terminal_buffer(terminal_buffer) { }
+
+  void load(const std::string& prefix);
+  void tick(uint64_t current_cycle);
+  // Saves the network at the end of current_cycle, or restores the
+  // network saved at the end of cycle
+  void save(const std::string& path, uint64_t current_cycle);
+  void restore(const std::string& path, uint64_t cycle);
+
+  uint64_t num_ingresses() { return ingresses.size(); }
+  uint64_t num_egresses() { return egresses.size(); }
+  // Describes the links of the network to router_stats_t, and numbers
+  // them in its order
+  std::string stats_layout();
+
+private:
+  static std::vector<std::vector<std::string>> read_lines(const std::string& path);
+  static bool parse_terminal(const std::string& token, char prefix, uint64_t* id);
+  uint64_t add_input(router_t& r, const std::string& name, uint64_t nvcs);
+
+  void ingress_tick(uint64_t ingress_id, uint64_t current_cycle);
+  void router_tick(uint64_t node, uint64_t current_cycle);
+  void egress_tick(uint64_t egress_id, uint64_t current_cycle);
+  void record_occupancy();
+  bool allocate(router_t& r, input_vc_t& vc, const flit_t& flit, uint64_t node);
+  void return_credit(uint64_t* credits, uint64_t current_cycle);
+  // Every credit counter, by which checkpoints refer to credit returns
+  std::vector<uint64_t*> credit_counters();
+
+  // Distinguishes network checkpoints from those of the traffic models
+  static const uint32_t CHECKPOINT_MODEL = 0x4e4f43; // "NOC"
+
+  uint64_t router_latency;
+  uint64_t link_latency;
+  uint64_t terminal_buffer;
+
+  std::vector<router_t> routers;
+  // Router and input port of each ingress, and credits of its buffer
+  std::vector<std::pair<uint64_t, uint64_t>> ingresses;
+  std::vector<uint64_t> ingress_credits;
+  // Flits buffered at each egress, and whether it accepted a flit
+  std::vector<ring_queue_t<model_flit_t>> egresses;
+  std::vector<uint64_t*> egress_credits;
+  std::vector<char> egress_ready;
+  // Credit returns in flight, in cycle order
+  ring_queue_t<credit_return_t> credit_returns;
+};
+
+std::vector<std::vector<std::string>> noc_model_t::read_lines(const std::string& path) {
+  std::ifstream stream(path);
+  if (stream.fail()) {
+    std::cout << "Unable to open " << path << std::endl;
+    exit(1);
+  }
+  std::vector<std::vector<std::string>> lines;
+  std::string line;
+  while (std::getline(stream, line)) {
+    std::istringstream tokens(line);
+    std::vector<std::string> tokenized;
+    std::string token;
+    while (tokens >> token) { tokenized.push_back(token); }
+    if (tokenized.size() > 0) { lines.push_back(tokenized); }
+  }
+  return lines;
+}
+
+bool noc_model_t::parse_terminal(const std::string& token, char prefix, uint64_t* id) {
+  if (token.size() < 2 || token[0] != prefix) { return false; }
+  *id = std::stoull(token.substr(1));
+  return true;
+}
+
+uint64_t noc_model_t::add_input(router_t& r, const std::string& name, uint64_t nvcs) {
+  input_port_t port;
+  port.name = name;
+  port.rr = 0;
+  port.stats_link = 0;
+  port.stats_vc = 0;
+  port.vcs.resize(nvcs);
+  for (input_vc_t& vc : port.vcs) {
+    vc.buffer = ring_queue_t<model_flit_t>(16);
+    vc.upstream_credits = NULL;
+    vc.out_port = -1;
+    vc.out_vc = 0;
+  }
+  r.inputs.push_back(port);
+  r.input_ids[name] = r.inputs.size() - 1;
+  return r.inputs.size() - 1;
+}
+
+void noc_model_t::load(const std::string& prefix) {
+  std::vector<std::vector<std::string>> adjlist = read_lines(prefix + "adjlist");
+  std::vector<std::vector<std::string>> edgeprops = read_lines(prefix + "edgeprops");
+  std::vector<std::vector<std::string>> routes = read_lines(prefix + "routes");
+
+  // Buffer depths of each virtual channel of each router-to-router channel
+  std::map<std::pair<uint64_t, uint64_t>, std::vector<uint64_t>> buffers;
+  for (auto& e : edgeprops) {
+    uint64_t id;
+    if (e.size() < 2 || parse_terminal(e[0], 'i', &id) || parse_terminal(e[1], 'e', &id)) {
+      continue;
+    }
+    for (size_t i = 2; i < e.size(); i++) {
+      if (e[i].rfind("buffers=", 0) != 0) { continue; }
+      std::istringstream depths(e[i].substr(strlen("buffers=")));
+      std::string depth;
+      std::vector<uint64_t>& vcs = buffers[std::make_pair(std::stoull(e[0]), std::stoull(e[1]))];
+      while (std::getline(depths, depth, ',')) { vcs.push_back(std::stoull(depth)); }
+    }
+  }
+
+  uint64_t num_nodes = 0;
+  for (auto& a : adjlist) {
+    uint64_t id;
+    if (!parse_terminal(a[0], 'i', &id)) { num_nodes = std::max(num_nodes, (uint64_t)std::stoull(a[0]) + 1); }
+  }
+  routers.resize(num_nodes);
+  for (router_t& r : routers) {
+    r.present = false;
+  }
+
+  // Output ports, with one credit per downstream buffer entry
+  for (auto& a : adjlist) {
+    uint64_t id;
+    if (parse_terminal(a[0], 'i', &id)) {
+      uint64_t node = std::stoull(a[1]);
+      if (ingresses.size() <= id) { ingresses.resize(id + 1); }
+      ingresses[id] = std::make_pair(node, add_input(routers[node], a[0], 1));
+      continue;
+    }
+    uint64_t node = std::stoull(a[0]);
+    router_t& r = routers[node];
+    r.present = true;
+    for (size_t i = 1; i < a.size(); i++) {
+      output_port_t port;
+      if (parse_terminal(a[i], 'e', &id)) {
+	port.dest_node = -1;
+	port.dest_port = 0;
+	port.egress_id = id;
+	port.vcs.push_back({terminal_buffer, false});
+	if (egresses.size() <= id) { egresses.resize(id + 1); }
+	r.egress_ports[id] = r.outputs.size();
+      } else {
+	uint64_t dest = std::stoull(a[i]);
+	auto it = buffers.find(std::make_pair(node, dest));
+	if (it == buffers.end() || it->second.size() == 0) {
+	  std::cout << "No buffers for channel " << node << " " << dest << " in " << prefix << "edgeprops" << std::endl;
+	  exit(1);
+	}
+	port.dest_node = dest;
+	port.dest_port = 0;
+	port.egress_id = -1;
+	for (uint64_t depth : it->second) { port.vcs.push_back({depth, false}); }
+	r.output_ids[dest] = r.outputs.size();
+      }
+      r.outputs.push_back(port);
+    }
+  }
+
+  // Input ports, linked to the credits of their upstream output port
+  for (uint64_t node = 0; node < num_nodes; node++) {
+    for (output_port_t& port : routers[node].outputs) {
+      if (port.dest_node < 0) { continue; }
+      router_t& dest = routers[port.dest_node];
+      port.dest_port = add_input(dest, std::to_string(node), port.vcs.size());
+      for (uint64_t v = 0; v < port.vcs.size(); v++) {
+	dest.inputs[port.dest_port].vcs[v].upstream_credits = &port.vcs[v].credits;
+      }
+    }
+  }
+  ingress_credits.resize(ingresses.size(), terminal_buffer);
+  for (uint64_t i = 0; i < ingresses.size(); i++) {
+    routers[ingresses[i].first].inputs[ingresses[i].second].vcs[0].upstream_credits = &ingress_credits[i];
+  }
+  egress_credits.resize(egresses.size(), NULL);
+  egress_ready.resize(egresses.size(), 1);
+  for (router_t& r : routers) {
+    for (auto& e : r.egress_ports) {
+      egress_credits[e.first] = &r.outputs[e.second].vcs[0].credits;
+    }
+  }
+
+  // <input> <node> <vc> <ingress> <egress> <output>:<vc> ...
+  for (auto& l : routes) {
+    if (l.size() < 5) { continue; }
+    router_t& r = routers[std::stoull(l[1])];
+    input_vc_t& vc = r.inputs[r.input_ids.at(l[0])].vcs[std::stoull(l[2])];
+    std::vector<std::pair<uint64_t, uint64_t>>& candidates = vc.routes[(std::stoull(l[3]) << 32) | std::stoull(l[4])];
+    for (size_t i = 5; i < l.size(); i++) {
+      size_t sep = l[i].find(':');
+      candidates.push_back(std::make_pair(r.output_ids.at(std::stoull(l[i].substr(0, sep))),
+					  std::stoull(l[i].substr(sep + 1))));
+    }
+  }
+}
+
+void noc_model_t::return_credit(uint64_t* credits, uint64_t current_cycle) {
+  credit_returns.push({current_cycle + link_latency, credits});
+}
+
+// Chooses an output virtual channel for the head flit at the front of vc,
+// returning false if all the candidates of its flow are held
+bool noc_model_t::allocate(router_t& r, input_vc_t& vc, const flit_t& flit, uint64_t node) {
+  auto egress = r.egress_ports.find(flit.egress_id);
+  if (egress != r.egress_ports.end()) {
+    output_vc_t& out = r.outputs[egress->second].vcs[0];
+    if (out.allocated) { return false; }
+    out.allocated = true;
+    vc.out_port = egress->second;
+    vc.out_vc = 0;
+    return true;
+  }
+  auto route = vc.routes.find((flit.ingress_id << 32) | flit.egress_id);
+  if (route == vc.routes.end() || route->second.size() == 0) {
+    std::cout << "No route for flow " << flit.ingress_id << " -> " << flit.egress_id
+	      << " at node " << node << std::endl;
+    exit(1);
+  }
+  for (auto& candidate : route->second) {
+    output_vc_t& out = r.outputs[candidate.first].vcs[candidate.second];
+    if (!out.allocated) {
+      out.allocated = true;
+      vc.out_port = candidate.first;
+      vc.out_vc = candidate.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+void noc_model_t::ingress_tick(uint64_t ingress_id, uint64_t current_cycle) {
+  router_t& r = routers[ingresses[ingress_id].first];
+  input_vc_t& vc = r.inputs[ingresses[ingress_id].second].vcs[0];
+  bool ready = ingress_credits[ingress_id] > 0;
+  flit_t* flit = eval->ingress_tick(ingress_id,
+				    current_cycle,
+				    ready,
+				    !params->in_drain(current_cycle),
+				    params->in_measurement(current_cycle));
+  if (flit) {
+    ingress_credits[ingress_id]--;
+    vc.buffer.push({*flit, current_cycle + link_latency + router_latency});
+    if (router_stats) {
+      router_stats->add_flits(r.inputs[ingresses[ingress_id].second].stats_link, 1);
+    }
+  }
+}
+
+void noc_model_t::router_tick(uint64_t node, uint64_t current_cycle) {
+  router_t& r = routers[node];
+  uint64_t ninputs = r.inputs.size();
+  // The input priority rotates with the cycle rather than per tick, so
+  // arbitration is unchanged by fast-forwarding over idle cycles
+  std::vector<char> output_busy(r.outputs.size(), 0);
+  for (uint64_t i = 0; i < ninputs; i++) {
+    input_port_t& in = r.inputs[(current_cycle + i) % ninputs];
+    uint64_t nvcs = in.vcs.size();
+    for (uint64_t j = 0; j < nvcs; j++) {
+      input_vc_t& vc = in.vcs[(in.rr + j) % nvcs];
+      if (vc.buffer.empty() || vc.buffer.front().ready_cycle > current_cycle) { continue; }
+      flit_t flit = vc.buffer.front().flit;
+      if (vc.out_port < 0 && !allocate(r, vc, flit, node)) {
+	if (router_stats) { router_stats->add_stalls(in.stats_link, 1, 0); }
+	continue;
+      }
+      output_port_t& out = r.outputs[vc.out_port];
+      output_vc_t& out_vc = out.vcs[vc.out_vc];
+      if (output_busy[vc.out_port] || out_vc.credits == 0) {
+	if (router_stats) { router_stats->add_stalls(in.stats_link, 0, 1); }
+	continue;
+      }
+
+      // Switch and link traversal
+      vc.buffer.pop();
+      return_credit(vc.upstream_credits, current_cycle);
+      output_busy[vc.out_port] = 1;
+      out_vc.credits--;
+      uint64_t arrival = current_cycle + link_latency;
+      input_port_t* dest = out.dest_node < 0 ? NULL : &routers[out.dest_node].inputs[out.dest_port];
+      if (dest) {
+	dest->vcs[vc.out_vc].buffer.push({flit, arrival + router_latency});
+      } else {
+	egresses[out.egress_id].push({flit, arrival});
+      }
+      if (router_stats) {
+	router_stats->add_flits(dest ? dest->stats_link : out.stats_link, 1);
+      }
+      if (flit.tail) {
+	out_vc.allocated = false;
+	vc.out_port = -1;
+      }
+      in.rr = (in.rr + j + 1) % nvcs;
+      break;
+    }
+  }
+}
+
+void noc_model_t::egress_tick(uint64_t egress_id, uint64_t current_cycle) {
+  ring_queue_t<model_flit_t>& buffer = egresses[egress_id];
+  bool valid = egress_ready[egress_id] && !buffer.empty() && buffer.front().ready_cycle <= current_cycle;
+  flit_t flit = valid ? buffer.front().flit : flit_t(false, false, 0, 0, 0, 0);
+  if (valid) {
+    buffer.pop();
+    return_credit(egress_credits[egress_id], current_cycle);
+  }
+  bool ready;
+  eval->egress_tick(egress_id,
+		    &ready,
+		    valid,
+		    flit.head,
+		    flit.tail,
+		    flit.ingress_id,
+		    flit.unique_id,
+		    current_cycle,
+		    params->in_measurement(current_cycle));
+  egress_ready[egress_id] = ready;
+}
+
+void noc_model_t::tick(uint64_t current_cycle) {
+  while (!credit_returns.empty() && credit_returns.front().cycle <= current_cycle) {
+    (*credit_returns.front().credits)++;
+    credit_returns.pop();
+  }
+  for (uint64_t i = 0; i < ingresses.size(); i++) {
+    ingress_tick(i, current_cycle);
+  }
+  // Flits forwarded this cycle are not ready before the next, so the
+  // order of the routers does not matter
+  for (uint64_t n = 0; n < routers.size(); n++) {
+    if (routers[n].present) {
+      router_tick(n, current_cycle);
+    }
+  }
+  for (uint64_t e = 0; e < egresses.size(); e++) {
+    egress_tick(e, current_cycle);
+  }
+  if (router_stats) {
+    record_occupancy();
+    router_stats->tick(current_cycle);
+  }
+}
+
+std::string noc_model_t::stats_layout() {
+  std::ostringstream layout;
+  uint64_t link = 0;
+  uint64_t vcs = 0;
+  for (uint64_t node = 0; node < routers.size(); node++) {
+    for (input_port_t& in : routers[node].inputs) {
+      layout << in.name << " " << node << " " << in.vcs.size() << " ";
+      in.stats_link = link++;
+      in.stats_vc = vcs;
+      vcs += in.vcs.size();
+    }
+  }
+  for (uint64_t node = 0; node < routers.size(); node++) {
+    for (output_port_t& out : routers[node].outputs) {
+      if (out.dest_node < 0) {
+	layout << node << " e" << out.egress_id << " 0 ";
+	out.stats_link = link++;
+      }
+    }
+  }
+  return layout.str();
+}
+
+// Flits buffered in each input virtual channel at the end of the cycle.
+// Cycles skipped by fast-forwarding have an empty network.
+void noc_model_t::record_occupancy() {
+  for (router_t& r : routers) {
+    for (input_port_t& in : r.inputs) {
+      for (uint64_t v = 0; v < in.vcs.size(); v++) {
+	router_stats->add_occupancy(in.stats_vc + v, in.vcs[v].buffer.size());
+      }
+    }
+  }
+}
+
+std::vector<uint64_t*> noc_model_t::credit_counters() {
+  std::vector<uint64_t*> counters;
+  for (uint64_t& credits : ingress_credits) {
+    counters.push_back(&credits);
+  }
+  for (router_t& r : routers) {
+    for (output_port_t& out : r.outputs) {
+      for (output_vc_t& vc : out.vcs) {
+	counters.push_back(&vc.credits);
+      }
+    }
+  }
+  return counters;
+}
+
+void noc_model_t::save(const std::string& path, uint64_t current_cycle) {
+  checkpoint_writer_t ckpt(path);
+  checkpoint_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CHECKPOINT_MAGIC;
+  header.version = CHECKPOINT_VERSION;
+  header.model = CHECKPOINT_MODEL;
+  header.num_ingresses = num_ingresses();
+  header.num_egresses = num_egresses();
+  header.cycle = current_cycle;
+  ckpt.put(header);
+  ckpt.put(router_latency);
+  ckpt.put(link_latency);
+  ckpt.put(terminal_buffer);
+  for (router_t& r : routers) {
+    ckpt.put<uint64_t>(r.inputs.size());
+    ckpt.put<uint64_t>(r.outputs.size());
+    for (input_port_t& in : r.inputs) {
+      ckpt.put(in.rr);
+      for (input_vc_t& vc : in.vcs) {
+	ckpt.put_queue(vc.buffer);
+	ckpt.put(vc.out_port);
+	ckpt.put(vc.out_vc);
+      }
+    }
+    for (output_port_t& out : r.outputs) {
+      ckpt.put_vector(out.vcs);
+    }
+  }
+  ckpt.put_vector(ingress_credits);
+  for (ring_queue_t<model_flit_t>& buffer : egresses) {
+    ckpt.put_queue(buffer);
+  }
+  ckpt.put_vector(egress_ready);
+  // Credit returns, as (cycle, counter index) pairs
+  std::vector<uint64_t*> counters = credit_counters();
+  std::unordered_map<uint64_t*, uint64_t> indices;
+  for (uint64_t i = 0; i < counters.size(); i++) {
+    indices[counters[i]] = i;
+  }
+  std::vector<uint64_t> returns;
+  for (ring_queue_t<credit_return_t> q = credit_returns; !q.empty(); q.pop()) {
+    returns.push_back(q.front().cycle);
+    returns.push_back(indices.at(q.front().credits));
+  }
+  ckpt.put_vector(returns);
+  if (!ckpt.close()) {
+    std::cout << "Unable to write network checkpoint " << path << std::endl;
+    exit(1);
+  }
+}
+
+void noc_model_t::restore(const std::string& path, uint64_t cycle) {
+  checkpoint_reader_t ckpt(path);
+  checkpoint_header_t header = ckpt.get<checkpoint_header_t>();
+  bool match = (!ckpt.fail() && header.magic == CHECKPOINT_MAGIC && header.version == CHECKPOINT_VERSION &&
+		header.model == CHECKPOINT_MODEL && header.cycle == cycle &&
+		header.num_ingresses == num_ingresses() && header.num_egresses == num_egresses() &&
+		ckpt.get<uint64_t>() == router_latency &&
+		ckpt.get<uint64_t>() == link_latency &&
+		ckpt.get<uint64_t>() == terminal_buffer);
+  for (uint64_t n = 0; match && n < routers.size(); n++) {
+    router_t& r = routers[n];
+    match = ckpt.get<uint64_t>() == r.inputs.size() && ckpt.get<uint64_t>() == r.outputs.size();
+    for (input_port_t& in : r.inputs) {
+      in.rr = ckpt.get<uint64_t>();
+      for (input_vc_t& vc : in.vcs) {
+	ckpt.get_queue(vc.buffer);
+	vc.out_port = ckpt.get<int64_t>();
+	vc.out_vc = ckpt.get<uint64_t>();
+      }
+    }
+    for (output_port_t& out : r.outputs) {
+      std::vector<output_vc_t> vcs = ckpt.get_vector<output_vc_t>();
+      match = match && vcs.size() == out.vcs.size();
+      // Counters stay in place, as credit returns point to them
+      for (uint64_t v = 0; match && v < vcs.size(); v++) {
+	out.vcs[v] = vcs[v];
+      }
+    }
+  }
+  std::vector<uint64_t> credits = ckpt.get_vector<uint64_t>();
+  match = match && credits.size() == ingress_credits.size();
+  if (match) {
+    std::copy(credits.begin(), credits.end(), ingress_credits.begin());
+  }
+  for (ring_queue_t<model_flit_t>& buffer : egresses) {
+    ckpt.get_queue(buffer);
+  }
+  std::vector<char> ready = ckpt.get_vector<char>();
+  match = match && ready.size() == egress_ready.size();
+  if (match) {
+    egress_ready = ready;
+  }
+  std::vector<uint64_t*> counters = credit_counters();
+  std::vector<uint64_t> returns = ckpt.get_vector<uint64_t>();
+  for (uint64_t i = 0; match && i + 1 < returns.size(); i += 2) {
+    match = returns[i + 1] < counters.size();
+    if (match) {
+      credit_returns.push({returns[i], counters[returns[i + 1]]});
+    }
+  }
+  if (!match || !ckpt.at_end()) {
+    std::cout << "Network checkpoint " << path << " does not match this network and cycle " << cycle << std::endl;
+    exit(1);
+  }
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s [--router-latency N] [--link-latency N] [--terminal-buffer N] "
+	  "<noceval.cfg> <path/to/name.noc.>\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  uint64_t router_latency = 2;
+  uint64_t link_latency = 1;
+  uint64_t terminal_buffer = 4;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.rfind("--", 0) == 0) {
+      if (i + 1 >= argc) { usage(argv[0]); }
+      uint64_t value = std::stoull(argv[++i]);
+      if (arg == "--router-latency") {
+	router_latency = value;
+      } else if (arg == "--link-latency") {
+	link_latency = value;
+      } else if (arg == "--terminal-buffer") {
+	terminal_buffer = value;
+      } else {
+	usage(argv[0]);
+      }
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.size() != 2 || link_latency == 0 || terminal_buffer == 0) { usage(argv[0]); }
+
+  std::ifstream config(positional[0]);
+  if (config.fail()) {
+    fprintf(stderr, "Unable to open %s\n", positional[0].c_str());
+    return 1;
+  }
+  std::stringstream config_str;
+  config_str << config.rdbuf();
+  init_params(config_str.str());
+  init_eval();
+
+  noc_model_t model(router_latency, link_latency, terminal_buffer);
+  model.load(positional[1]);
+  if (model.num_ingresses() != params->num_ingresses || model.num_egresses() != params->num_egresses) {
+    fprintf(stderr, "Config has %llu ingresses and %llu egresses, but the network has %llu and %llu\n",
+	    (unsigned long long)params->num_ingresses, (unsigned long long)params->num_egresses,
+	    (unsigned long long)model.num_ingresses(), (unsigned long long)model.num_egresses());
+    return 1;
+  }
+
+  init_router_stats(model.stats_layout());
+
+  // A restored run resumes after the cycle of its checkpoint
+  uint64_t cycle = params->resume_cycle;
+  if (!params->checkpoint_restore_file.empty()) {
+    model.restore(params->checkpoint_restore_file + ".noc", cycle - 1);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  unsigned char success = 0;
+  unsigned char fatal = 0;
+  while (!success && !fatal) {
+    model.tick(cycle);
+    if (checkpoint_save_due(cycle)) {
+      save_checkpoint(params->checkpoint_save_file, cycle);
+      model.save(params->checkpoint_save_file + ".noc", cycle);
+    }
+    check_eval_done(cycle, &success, &fatal);
+    cycle = get_next_tick_cycle(cycle);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("Simulated %llu cycles in %.3f s\n", (unsigned long long)(cycle - params->resume_cycle), seconds);
+  return fatal ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#ifndef __CONSTELLATION_TRACEBINARY_H
+#define __CONSTELLATION_TRACEBINARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Uncompressed binary form of a netrace trace, produced by trace_convert.
+ * The file is laid out to be mmap'd and read in place:
+ *
+ *  trace_binary_header_t
+ *  trace_binary_region_t  regions[num_regions]
+ *  trace_binary_packet_t  packets[num_packets]
+ *  uint32_t               deps[num_deps]
+ *
+ * Packets are fixed-size records in trace order. Each packet's dependencies
+ * are num_deps consecutive entries of deps starting at deps_offset. Regions
+ * index their first packet, so seeking to a region is O(1).
+ */
+
+#define TRACE_BINARY_MAGIC   0x42544e43 // "CNTB"
+#define TRACE_BINARY_VERSION 1
+
+typedef struct trace_binary_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_nodes;
+  uint32_t num_regions;
+  uint64_t num_packets;
+  uint64_t num_deps;
+} trace_binary_header_t;
+
+typedef struct trace_binary_region_t {
+  uint64_t first_packet;
+  uint64_t num_packets;
+  uint64_t num_cycles;
+} trace_binary_region_t;
+
+typedef struct trace_binary_packet_t {
+  uint64_t cycle;
+  uint64_t deps_offset;
+  uint32_t id;
+  uint32_t addr;
+  uint8_t type;
+  uint8_t src;
+  uint8_t dst;
+  uint8_t node_types;
+  uint8_t num_deps;
+  uint8_t pad[3];
+} trace_binary_packet_t;
+
+static_assert(sizeof(trace_binary_header_t) == 32, "trace_binary_header_t layout");
+static_assert(sizeof(trace_binary_region_t) == 24, "trace_binary_region_t layout");
+static_assert(sizeof(trace_binary_packet_t) == 32, "trace_binary_packet_t layout");
+
+// Read-only mapping of a binary trace. The mapping is shared, so parallel
+// simulations replaying the same trace share its pages in the page cache.
+class trace_binary_t
+{
+public:
+  trace_binary_t() : base(NULL), length(0) { }
+  ~trace_binary_t() {
+    if (base) { munmap(base, length); }
+  }
+
+  // Returns true if the file at path starts with the binary trace magic
+  static bool is_binary_trace(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+    uint32_t magic = 0;
+    bool binary = ::read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == TRACE_BINARY_MAGIC;
+    ::close(fd);
+    return binary;
+  }
+
+  // Maps the trace, returning false if it cannot be mapped or is malformed
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(trace_binary_header_t)) {
+      ::close(fd);
+      return false;
+    }
+    length = st.st_size;
+    base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      base = NULL;
+      return false;
+    }
+    madvise(base, length, MADV_SEQUENTIAL);
+
+    const trace_binary_header_t* h = header();
+    size_t expected = (sizeof(trace_binary_header_t) +
+		       h->num_regions * sizeof(trace_binary_region_t) +
+		       h->num_packets * sizeof(trace_binary_packet_t) +
+		       h->num_deps * sizeof(uint32_t));
+    return h->magic == TRACE_BINARY_MAGIC && h->version == TRACE_BINARY_VERSION && length >= expected;
+  }
+
+  const trace_binary_header_t* header() const {
+    return (const trace_binary_header_t*)base;
+  }
+  const trace_binary_region_t* regions() const {
+    return (const trace_binary_region_t*)(header() + 1);
+  }
+  const trace_binary_packet_t* packets() const {
+    return (const trace_binary_packet_t*)(regions() + header()->num_regions);
+  }
+  // Dependencies of every packet, indexed by deps_offset
+  const uint32_t* all_deps() const {
+    return (const uint32_t*)(packets() + header()->num_packets);
+  }
+  const uint32_t* deps(const trace_binary_packet_t* packet) const {
+    return all_deps() + packet->deps_offset;
+  }
+
+private:
+  void* base;
+  size_t length;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Converts a netrace .tra.bz2 trace to the uncompressed binary trace
+ * format of TraceBinary.h, which TrafficEval replays through mmap.
+ *
+ * Usage: trace_convert <input.tra.bz2> <output.ntb>
+ */
+
+#include "TraceBinary.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include "netrace.h"
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <input.tra.bz2> <output.ntb>\n", argv[0]);
+    return 1;
+  }
+
+  nt_context_t ctx;
+  memset(&ctx, 0, sizeof(nt_context_t));
+  nt_open_trfile(&ctx, argv[1]);
+  nt_disable_dependencies(&ctx);
+  nt_header_t* nt_header = nt_get_trheader(&ctx);
+
+  std::vector<trace_binary_packet_t> packets;
+  std::vector<uint32_t> deps;
+  nt_packet_t* packet;
+  while ((packet = nt_read_packet(&ctx)) != NULL) {
+    trace_binary_packet_t record;
+    memset(&record, 0, sizeof(record));
+    record.cycle = packet->cycle;
+    record.deps_offset = deps.size();
+    record.id = packet->id;
+    record.addr = packet->addr;
+    record.type = packet->type;
+    record.src = packet->src;
+    record.dst = packet->dst;
+    record.node_types = packet->node_types;
+    record.num_deps = packet->num_deps;
+    for (uint64_t i = 0; i < packet->num_deps; i++) {
+      deps.push_back(packet->deps[i]);
+    }
+    packets.push_back(record);
+    nt_packet_free(packet);
+  }
+
+  // Regions are consecutive runs of packets in the trace
+  std::vector<trace_binary_region_t> regions(nt_header->num_regions);
+  uint64_t first_packet = 0;
+  for (uint64_t i = 0; i < regions.size(); i++) {
+    regions[i].first_packet = first_packet;
+    regions[i].num_packets = nt_header->regions[i].num_packets;
+    regions[i].num_cycles = nt_header->regions[i].num_cycles;
+    first_packet += regions[i].num_packets;
+  }
+  if (first_packet != packets.size()) {
+    fprintf(stderr, "Region headers list %llu packets, but the trace has %llu\n",
+	    (unsigned long long)first_packet, (unsigned long long)packets.size());
+    nt_close_trfile(&ctx);
+    return 1;
+  }
+
+  trace_binary_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_BINARY_MAGIC;
+  header.version = TRACE_BINARY_VERSION;
+  header.num_nodes = nt_header->num_nodes;
+  header.num_regions = regions.size();
+  header.num_packets = packets.size();
+  header.num_deps = deps.size();
+  // Closing the trace frees nt_header
+  nt_close_trfile(&ctx);
+
+  FILE* out = fopen(argv[2], "wb");
+  if (!out) {
+    fprintf(stderr, "Unable to open %s\n", argv[2]);
+    return 1;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, out) == 1 &&
+	     fwrite(regions.data(), sizeof(trace_binary_region_t), regions.size(), out) == regions.size() &&
+	     fwrite(packets.data(), sizeof(trace_binary_packet_t), packets.size(), out) == packets.size() &&
+	     fwrite(deps.data(), sizeof(uint32_t), deps.size(), out) == deps.size());
+  ok = fclose(out) == 0 && ok;
+  if (!ok) {
+    fprintf(stderr, "Error writing %s\n", argv[2]);
+    return 1;
+  }
+  printf("Converted %llu packets in %llu regions\n",
+	 (unsigned long long)packets.size(), (unsigned long long)regions.size());
+  return 0;
+}
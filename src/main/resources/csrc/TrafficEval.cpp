@@ -4,13 +4,26 @@
 #include <fstream>
 #include <sstream>
 #include <cstring>
+#include <thread>
+#include <chrono>
+#include <numeric>
 #ifndef NO_VPI
 #include <vpi_user.h>
+#endif
+#ifndef NO_DPI
 #include <svdpi.h>
 #endif
 
 runtime_params_t* params = NULL;
 traffic_eval_t* eval = NULL;
+load_sweep_t* sweep = NULL;
+adaptive_measurement_t* adaptive = NULL;
+telemetry_t* telemetry = NULL;
+request_response_traffic_eval_t* request_response = NULL;
+watchdog_t* watchdog = NULL;
+router_stats_t* router_stats = NULL;
+// Wall-clock start of the evaluation, for the results file
+static std::chrono::steady_clock::time_point start_time;
 
 /*
  * Initializes the global runtime_params_t object for one evaluation
@@ -64,13 +77,112 @@ void init_params(std::string config_str) {
   params = new runtime_params_t(config);
 }
 
+// Traffic models, as selected by params. Checkpoints record the model
+// which saved them.
+enum traffic_model_t {
+  REQUEST_RESPONSE_MODEL,
+  NETRACE_MODEL,
+  PATTERN_MODEL,
+  FLOWS_MODEL
+};
+
+static traffic_model_t get_traffic_model() {
+  if (params->request_window > 0) {
+    return REQUEST_RESPONSE_MODEL;
+  } else if (params->netrace_enable) {
+    return NETRACE_MODEL;
+  } else if (!params->pattern.empty()) {
+    return PATTERN_MODEL;
+  }
+  return FLOWS_MODEL;
+}
+
 void init_eval() {
   assert(params && !eval);
-  if (params->netrace_enable) {
+  start_time = std::chrono::steady_clock::now();
+  switch (get_traffic_model()) {
+  case REQUEST_RESPONSE_MODEL:
+    eval = request_response = new request_response_traffic_eval_t(params);
+    break;
+  case NETRACE_MODEL:
     eval = new netrace_traffic_eval_t(params);
-  } else {
+    break;
+  case PATTERN_MODEL:
+    eval = new pattern_traffic_eval_t(params);
+    break;
+  case FLOWS_MODEL:
     eval = new random_traffic_eval_t(params);
+    break;
+  }
+  if (params->sweep_enable) {
+    sweep = new load_sweep_t(params, eval);
+  }
+  if (params->adaptive_enable) {
+    adaptive = new adaptive_measurement_t(params, eval);
+  }
+  // Restored after the sweep sets its first load, which resets the
+  // generators, and before the telemetry and watchdog take their start
+  if (!params->checkpoint_restore_file.empty()) {
+    params->resume_cycle = restore_checkpoint(params->checkpoint_restore_file) + 1;
+  }
+  if (params->telemetry_window > 0) {
+    telemetry = new telemetry_t(params, eval);
+  }
+  if (params->watchdog_cycles > 0) {
+    watchdog = new watchdog_t(params, eval);
+  }
+}
+
+void init_router_stats(const std::string& layout) {
+  assert(params && !router_stats);
+  if (params->router_stats_window > 0) {
+    router_stats = new router_stats_t(params, layout);
+  }
+}
+
+/*
+ * Initializes the params and eval on the first tick of any terminal. Under
+ * a multi-threaded simulator, the first ticks may race.
+ */
+static std::once_flag init_flag;
+static void init_once(const char* config_str) {
+  std::call_once(init_flag, [config_str] {
+    init_params(std::string(config_str));
+    init_eval();
+  });
+}
+
+/*
+ * Per-terminal DPI calls of one cycle may run concurrently, so the end of
+ * cycle bookkeeping of check_eval_done runs in whichever tick of the cycle
+ * is the last, once every terminal has ticked. Its outcome is latched, and
+ * reported by egress 0 on its next tick. The simulator completes the
+ * calls of one edge before starting the next, which orders the cycles.
+ */
+static std::atomic<uint64_t> terminal_ticks(0);
+static std::atomic<bool> eval_success(false);
+static std::atomic<bool> eval_fatal(false);
+static void finish_terminal_tick(uint64_t current_cycle) {
+  uint64_t num_terminals = params->num_ingresses + params->num_egresses;
+  if (terminal_ticks.fetch_add(1, std::memory_order_acq_rel) + 1 < num_terminals) {
+    return;
   }
+  terminal_ticks.store(0, std::memory_order_relaxed);
+  // The simulator's state is saved between cycles, while these ticks are
+  // spread over the evaluation of a cycle
+  if (!params->checkpoint_save_file.empty() || !params->checkpoint_restore_file.empty()) {
+    std::cout << "Checkpoints require batched DPI" << std::endl;
+    exit(1);
+  }
+  // The run is over once decided, so the results are printed once
+  if (eval_success.load(std::memory_order_relaxed) || eval_fatal.load(std::memory_order_relaxed)) {
+    return;
+  }
+  unsigned char success;
+  unsigned char fatal;
+  check_eval_done(current_cycle, &success, &fatal);
+  eval_success.store(success, std::memory_order_relaxed);
+  eval_fatal.store(fatal, std::memory_order_relaxed);
 }
 
 extern "C" void ingress_tick(long long int ingress_id,
@@ -83,8 +195,7 @@ extern "C" void ingress_tick(long long int ingress_id,
 			     long long int* flit_out_egress_id,
 			     long long int* flit_out_unique_id
 			     ) {
-  if (!params) { init_params(std::string(config_str)); }
-  if (!eval) { init_eval(); }
+  init_once(config_str);
 
   // Stop generating packets in drain phase
   // Only count sent flits in measurement phase
@@ -100,6 +211,505 @@ extern "C" void ingress_tick(long long int ingress_id,
     *flit_out_egress_id = flit_to_send->egress_id;
     *flit_out_unique_id = flit_to_send->unique_id;
   }
+  finish_terminal_tick(current_cycle);
+}
+
+// Statistics of one flow over the measurement phase
+typedef struct flow_result_t {
+  uint64_t ingress_id;
+  uint64_t egress_id;
+  uint64_t received;
+  uint64_t sent;
+  float throughput;
+  uint64_t median_latency;
+  uint64_t max_latency;
+  uint64_t p90_latency;
+  uint64_t p99_latency;
+  uint64_t p999_latency;
+  // Packet latencies, with packet_stats
+  uint64_t packets;
+  uint64_t packet_median_latency;
+  uint64_t packet_p99_latency;
+  uint64_t median_queueing;
+  uint64_t p99_queueing;
+  uint64_t median_network;
+  uint64_t p99_network;
+} flow_result_t;
+
+static std::string json_string(const std::string& s) {
+  std::string quoted = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if ((unsigned char)c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+// JSON has no infinities or NaNs, which flows with no sent flits produce
+static std::string json_number(double v) {
+  if (!std::isfinite(v)) { return "null"; }
+  std::ostringstream ss;
+  ss << v;
+  return ss.str();
+}
+
+/*
+ * Prints the statistics of each traffic class, so the latency quantiles
+ * of high- and low-priority classes sharing the network can be compared
+ */
+static void print_class_results(std::ostream& os) {
+  os << "Class results CSV:" << std::endl;
+  os << "class, name, received, sent, throughput, median_latency, max_latency, p90_latency, p99_latency, p999_latency" << std::endl;
+  for (uint64_t c = 0; c < eval->get_num_classes(); c++) {
+    uint64_t received = eval->get_class_flits_received(c);
+    uint64_t sent = eval->get_class_flits_sent(c);
+    const latency_hist_t<uint64_t>& hist = eval->get_class_latencies(c);
+    os << c << ", "
+       << params->traffic_classes[c] << ", "
+       << received << ", "
+       << sent << ", "
+       << std::to_string((float)received / (float)sent) << ", "
+       << hist.median() << ", "
+       << hist.max() << ", "
+       << hist.quantile(0.9) << ", "
+       << hist.quantile(0.99) << ", "
+       << hist.quantile(0.999)
+       << std::endl;
+  }
+  if (params->packet_stats) {
+    os << "Class packet latency CSV:" << std::endl;
+    os << "class, name, packets, median_latency, p99_latency, median_queueing, p99_queueing, median_network, p99_network" << std::endl;
+    for (uint64_t c = 0; c < eval->get_num_classes(); c++) {
+      const packet_latencies_t<uint64_t>& packets = eval->get_class_packet_latencies(c);
+      os << c << ", "
+	 << params->traffic_classes[c] << ", "
+	 << packets.total.count() << ", "
+	 << packets.total.median() << ", "
+	 << packets.total.quantile(0.99) << ", "
+	 << packets.queueing.median() << ", "
+	 << packets.queueing.quantile(0.99) << ", "
+	 << packets.network.median() << ", "
+	 << packets.network.quantile(0.99)
+	 << std::endl;
+    }
+  }
+}
+
+/*
+ * Writes the run parameters, phase boundaries, per-flow and per-class
+ * statistics, overall latency histogram and simulation speed to the
+ * results_file as JSON. On timeout, no flows are reported, and a stall
+ * detected by the watchdog is reported with its reason.
+ */
+static void write_results_file(uint64_t current_cycle, const std::vector<flow_result_t>& results,
+			       bool success, bool timed_out) {
+  std::ofstream os(params->results_file);
+  if (os.fail()) {
+    std::cout << "Unable to open results file " << params->results_file << std::endl;
+    return;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  const char* traffic = (params->netrace_enable ? "netrace" :
+			 !params->pattern.empty() ? "pattern" :
+			 request_response ? "request_response" : "flows");
+  os << "{\n"
+     << "  \"params\": {\n"
+     << "    \"traffic\": \"" << traffic << "\",\n"
+     << "    \"num_ingresses\": " << params->num_ingresses << ",\n"
+     << "    \"num_egresses\": " << params->num_egresses << ",\n"
+     << "    \"flits_per_packet\": " << params->flits_per_packet << ",\n"
+     << "    \"seed\": " << params->seed << ",\n";
+  if (params->netrace_enable) {
+    os << "    \"netrace_trace\": " << json_string(params->netrace_trace) << ",\n"
+       << "    \"netrace_region\": " << params->netrace_region << ",\n";
+  } else if (!params->pattern.empty()) {
+    os << "    \"pattern\": " << json_string(params->pattern) << ",\n"
+       << "    \"pattern_rate\": " << json_number(params->pattern_rate) << ",\n";
+  }
+  os << "    \"warmup_cycles\": " << params->warmup_cycles << ",\n"
+     << "    \"measurement_cycles\": " << params->measurement_cycles << ",\n"
+     << "    \"drain_timeout_cycles\": " << params->drain_timeout_cycles << "\n"
+     << "  },\n"
+     << "  \"phases\": {\n"
+     << "    \"warmup_end_cycle\": " << params->warmup_cycles << ",\n"
+     << "    \"measurement_end_cycle\": " << params->warmup_cycles + params->measurement_cycles << ",\n"
+     << "    \"start_cycle\": " << params->resume_cycle << ",\n"
+     << "    \"end_cycle\": " << current_cycle << "\n"
+     << "  },\n"
+     << "  \"wall_clock_seconds\": " << json_number(seconds) << ",\n"
+     << "  \"cycles_per_second\": " << json_number((current_cycle + 1 - params->resume_cycle) / seconds) << ",\n"
+     << "  \"success\": " << (success ? "true" : "false") << ",\n"
+     << "  \"timed_out\": " << (timed_out ? "true" : "false");
+  if (timed_out && watchdog && !watchdog->get_reason().empty()) {
+    os << ",\n  \"watchdog\": " << json_string(watchdog->get_reason());
+  }
+  if (timed_out) {
+    os << "\n}\n";
+    return;
+  }
+
+  os << ",\n  \"flows\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const flow_result_t& r = results[i];
+    os << (i ? ",\n" : "\n")
+       << "    {\"ingress_id\": " << r.ingress_id
+       << ", \"egress_id\": " << r.egress_id
+       << ", \"received\": " << r.received
+       << ", \"sent\": " << r.sent
+       << ", \"throughput\": " << json_number(r.throughput)
+       << ", \"median_latency\": " << r.median_latency
+       << ", \"max_latency\": " << r.max_latency
+       << ", \"p90_latency\": " << r.p90_latency
+       << ", \"p99_latency\": " << r.p99_latency
+       << ", \"p999_latency\": " << r.p999_latency;
+    if (params->packet_stats) {
+      os << ", \"packets\": " << r.packets
+	 << ", \"packet_median_latency\": " << r.packet_median_latency
+	 << ", \"packet_p99_latency\": " << r.packet_p99_latency
+	 << ", \"median_queueing\": " << r.median_queueing
+	 << ", \"p99_queueing\": " << r.p99_queueing
+	 << ", \"median_network\": " << r.median_network
+	 << ", \"p99_network\": " << r.p99_network;
+    }
+    os << "}";
+  }
+  os << "\n  ],\n";
+
+  const latency_hist_t<uint64_t>& hist = eval->get_overall_latencies();
+  os << "  \"latency\": {\n"
+     << "    \"count\": " << hist.count() << ",\n"
+     << "    \"mean\": " << json_number(hist.mean()) << ",\n"
+     << "    \"median\": " << hist.median() << ",\n"
+     << "    \"p90\": " << hist.quantile(0.9) << ",\n"
+     << "    \"p99\": " << hist.quantile(0.99) << ",\n"
+     << "    \"p999\": " << hist.quantile(0.999) << ",\n"
+     << "    \"max\": " << hist.max() << ",\n"
+     << "    \"histogram\": [";
+  // Non-empty buckets, as [low, high) bounds and a count
+  bool first = true;
+  for (uint64_t i = 0; i < latency_hist_t<uint64_t>::NUM_BUCKETS; i++) {
+    uint64_t c = hist.bucket_count(i);
+    if (c == 0) { continue; }
+    os << (first ? "" : ", ") << "[" << latency_hist_t<uint64_t>::bucket_low(i)
+       << ", " << latency_hist_t<uint64_t>::bucket_high(i) << ", " << c << "]";
+    first = false;
+  }
+  os << "]\n  }";
+  if (params->packet_stats) {
+    const packet_latencies_t<uint64_t>& packets = eval->get_overall_packet_latencies();
+    const char* names[] = { "total", "queueing", "network" };
+    const latency_hist_t<uint64_t>* hists[] = { &packets.total, &packets.queueing, &packets.network };
+    os << ",\n  \"packet_latency\": {\n"
+       << "    \"count\": " << packets.total.count();
+    for (int i = 0; i < 3; i++) {
+      os << ",\n    \"" << names[i] << "\": {\"mean\": " << json_number(hists[i]->mean())
+	 << ", \"median\": " << hists[i]->median()
+	 << ", \"p99\": " << hists[i]->quantile(0.99)
+	 << ", \"max\": " << hists[i]->max() << "}";
+    }
+    os << "\n  }";
+  }
+  if (eval->get_num_classes() > 1) {
+    os << ",\n  \"classes\": [";
+    for (uint64_t c = 0; c < eval->get_num_classes(); c++) {
+      uint64_t received = eval->get_class_flits_received(c);
+      uint64_t sent = eval->get_class_flits_sent(c);
+      const latency_hist_t<uint64_t>& hist = eval->get_class_latencies(c);
+      os << (c ? ",\n" : "\n")
+	 << "    {\"class\": " << c
+	 << ", \"name\": " << json_string(params->traffic_classes[c])
+	 << ", \"received\": " << received
+	 << ", \"sent\": " << sent
+	 << ", \"throughput\": " << json_number((double)received / (double)sent)
+	 << ", \"median_latency\": " << hist.median()
+	 << ", \"max_latency\": " << hist.max()
+	 << ", \"p90_latency\": " << hist.quantile(0.9)
+	 << ", \"p99_latency\": " << hist.quantile(0.99)
+	 << ", \"p999_latency\": " << hist.quantile(0.999);
+      if (params->packet_stats) {
+	const packet_latencies_t<uint64_t>& packets = eval->get_class_packet_latencies(c);
+	os << ", \"packets\": " << packets.total.count()
+	   << ", \"packet_median_latency\": " << packets.total.median()
+	   << ", \"packet_p99_latency\": " << packets.total.quantile(0.99)
+	   << ", \"median_queueing\": " << packets.queueing.median()
+	   << ", \"p99_queueing\": " << packets.queueing.quantile(0.99)
+	   << ", \"median_network\": " << packets.network.median()
+	   << ", \"p99_network\": " << packets.network.quantile(0.99);
+      }
+      os << "}";
+    }
+    os << "\n  ]";
+  }
+  if (params->source_queue_limit > 0) {
+    uint64_t accepted = 0;
+    uint64_t dropped = 0;
+    uint64_t throttled = 0;
+    os << ",\n  \"source_queue\": {\"limit\": " << params->source_queue_limit
+       << ", \"policy\": \"" << (params->source_queue_throttle ? "throttle" : "drop") << "\""
+       << ", \"ingresses\": [";
+    for (uint64_t i = 0; i < params->num_ingresses; i++) {
+      os << (i ? ", " : "")
+	 << "{\"ingress_id\": " << i
+	 << ", \"accepted_flits\": " << eval->get_ingress_flits_sent(i)
+	 << ", \"dropped_flits\": " << eval->get_flits_dropped(i)
+	 << ", \"throttled_cycles\": " << eval->get_throttled_cycles(i) << "}";
+      accepted += eval->get_ingress_flits_sent(i);
+      dropped += eval->get_flits_dropped(i);
+      throttled += eval->get_throttled_cycles(i);
+    }
+    os << "], \"accepted_flits\": " << accepted
+       << ", \"dropped_flits\": " << dropped
+       << ", \"throttled_cycles\": " << throttled << "}";
+  }
+  if (request_response) {
+    os << ",\n  \"request_response\": ";
+    request_response->print_json(os);
+  }
+  if (adaptive) {
+    os << ",\n  \"adaptive\": ";
+    adaptive->print_json(os);
+  }
+  if (sweep) {
+    os << ",\n  \"sweep\": ";
+    sweep->print_json(os);
+  }
+  os << "\n}\n";
+}
+
+/*
+ * Checks whether the evaluation has finished, once per cycle, after every
+ * terminal has ticked. On completion, prints the results and sets success,
+ * or fatal if the requirements were not met. Sets fatal on timeout. Reads
+ * and resets the statistics of every shard, so must not race with the
+ * ticks.
+ */
+void check_eval_done(uint64_t current_cycle, unsigned char* success, unsigned char* fatal) {
+  *success = 0;
+  *fatal = 0;
+  if (sweep) {
+    sweep->tick(current_cycle);
+  }
+  if (adaptive) {
+    adaptive->tick(current_cycle);
+  }
+  // After the sweep, which may flush the ingress queues
+  eval->count_inflight_flits();
+  if (telemetry) {
+    telemetry->tick(current_cycle);
+  }
+  bool stalled = watchdog && watchdog->tick(current_cycle);
+  if (stalled || params->timed_out(current_cycle)) {
+    if (stalled) {
+      std::cout << "Error, traffic eval stalled" << std::endl;
+      watchdog->print_diagnostics(std::cout, current_cycle);
+    } else {
+      std::cout << "Error, traffic eval timed out" << std::endl;
+    }
+    if (telemetry) {
+      telemetry->finish(current_cycle);
+    }
+    if (router_stats) {
+      router_stats->finish(current_cycle);
+    }
+    eval->finish();
+    if (!params->results_file.empty()) {
+      write_results_file(current_cycle, std::vector<flow_result_t>(), false, true);
+    }
+    *fatal = 1;
+  } else if (params->in_drain(current_cycle) && eval->no_inflight_flits()) {
+    if (telemetry) {
+      telemetry->finish(current_cycle);
+    }
+    if (router_stats) {
+      router_stats->finish(current_cycle);
+    }
+    eval->finish();
+    // Traces and patterns have no explicit flows, so report every flow
+    // which saw traffic
+    std::vector<flow_rate_t> flows = params->flow_rates;
+    if (flows.empty()) {
+      flows = eval->get_active_flows();
+    }
+    std::vector<flow_result_t> results;
+    results.reserve(flows.size());
+    float min_throughput = std::numeric_limits<float>::max();
+    const flow_result_t* min_flow = NULL;
+    for (flow_rate_t& flow : flows) {
+      flow_result_t r;
+      r.ingress_id = flow.ingress_id;
+      r.egress_id = flow.egress_id;
+      r.received = eval->get_flits_received(flow);
+      r.sent = eval->get_flits_sent(flow);
+      r.throughput = (float)r.received / (float)r.sent;
+      r.median_latency = eval->get_median_latency(flow);
+      r.max_latency = eval->get_max_latency(flow);
+      r.p90_latency = eval->get_latency_quantile(flow, 0.9);
+      r.p99_latency = eval->get_latency_quantile(flow, 0.99);
+      r.p999_latency = eval->get_latency_quantile(flow, 0.999);
+      if (params->packet_stats) {
+	const packet_latencies_t<uint32_t>& packets = eval->get_packet_latencies(flow);
+	r.packets = packets.total.count();
+	r.packet_median_latency = packets.total.median();
+	r.packet_p99_latency = packets.total.quantile(0.99);
+	r.median_queueing = packets.queueing.median();
+	r.p99_queueing = packets.queueing.quantile(0.99);
+	r.median_network = packets.network.median();
+	r.p99_network = packets.network.quantile(0.99);
+      }
+      results.push_back(r);
+    }
+    std::cout << "Results CSV:" << std::endl;
+    std::cout << "ingress_id, egress_id, received, sent, throughput, median_latency, max_latency, p90_latency, p99_latency, p999_latency" << std::endl;
+    for (const flow_result_t& r : results) {
+      if (r.throughput < min_throughput || !min_flow) {
+	min_throughput = r.throughput;
+	min_flow = &r;
+      }
+      std::cout << r.ingress_id << ", "
+		<< r.egress_id << ", "
+		<< r.received << ", "
+		<< r.sent << ", "
+		<< std::to_string(r.throughput) << ", "
+		<< r.median_latency << ", "
+		<< r.max_latency << ", "
+		<< r.p90_latency << ", "
+		<< r.p99_latency << ", "
+		<< r.p999_latency
+		<< std::endl;
+    }
+    uint64_t max_latency = eval->get_overall_max_latency();
+    uint64_t median_latency = eval->get_overall_median_latency();
+    if (min_flow) {
+      std::cout << std::endl
+		<< "Min throughput: "
+		<< min_flow->ingress_id << ", "
+		<< min_flow->egress_id << ", "
+		<< min_throughput;
+    } else {
+      min_throughput = 0.0f;
+    }
+    std::cout << std::endl
+	      << "Median latency: "
+	      << median_latency
+	      << std::endl
+	      << "P90 latency: "
+	      << eval->get_overall_latency_quantile(0.9)
+	      << std::endl
+	      << "P99 latency: "
+	      << eval->get_overall_latency_quantile(0.99)
+	      << std::endl
+	      << "P99.9 latency: "
+	      << eval->get_overall_latency_quantile(0.999)
+	      << std::endl
+	      << "Max latency: "
+	      << max_latency
+	      << std::endl
+	      << "Latency hist: ";
+    // Coalesce histogram buckets into bins at least bin_size wide
+    const latency_hist_t<uint64_t>& hist = eval->get_overall_latencies();
+    uint64_t bin_size = 10;
+    uint64_t bin_low = 0;
+    uint64_t c = 0;
+    for (uint64_t i = 0; i < latency_hist_t<uint64_t>::NUM_BUCKETS && bin_low <= max_latency; i++) {
+      c += hist.bucket_count(i);
+      uint64_t bin_high = latency_hist_t<uint64_t>::bucket_high(i);
+      if (bin_high - bin_low >= bin_size) {
+	std::cout << "  " << bin_low << "-" << bin_high << ": " << c << std::endl;
+	bin_low = bin_high;
+	c = 0;
+      }
+    }
+
+    if (params->packet_stats) {
+      std::cout << "Packet latency CSV:" << std::endl;
+      std::cout << "ingress_id, egress_id, packets, median_latency, p99_latency, median_queueing, p99_queueing, median_network, p99_network" << std::endl;
+      for (const flow_result_t& r : results) {
+	std::cout << r.ingress_id << ", "
+		  << r.egress_id << ", "
+		  << r.packets << ", "
+		  << r.packet_median_latency << ", "
+		  << r.packet_p99_latency << ", "
+		  << r.median_queueing << ", "
+		  << r.p99_queueing << ", "
+		  << r.median_network << ", "
+		  << r.p99_network
+		  << std::endl;
+      }
+      const packet_latencies_t<uint64_t>& packets = eval->get_overall_packet_latencies();
+      std::cout << "Packet median latency: " << packets.total.median() << std::endl
+		<< "Packet P99 latency: " << packets.total.quantile(0.99) << std::endl
+		<< "Packet median queueing: " << packets.queueing.median() << std::endl
+		<< "Packet P99 queueing: " << packets.queueing.quantile(0.99) << std::endl
+		<< "Packet median network latency: " << packets.network.median() << std::endl
+		<< "Packet P99 network latency: " << packets.network.quantile(0.99) << std::endl;
+    }
+    if (eval->get_num_classes() > 1) {
+      print_class_results(std::cout);
+    }
+
+    if (params->source_queue_limit > 0) {
+      std::cout << "Source queue CSV:" << std::endl;
+      std::cout << "ingress_id, accepted_flits, dropped_flits, throttled_cycles" << std::endl;
+      uint64_t accepted = 0;
+      uint64_t dropped = 0;
+      uint64_t throttled = 0;
+      for (uint64_t i = 0; i < params->num_ingresses; i++) {
+	std::cout << i << ", "
+		  << eval->get_ingress_flits_sent(i) << ", "
+		  << eval->get_flits_dropped(i) << ", "
+		  << eval->get_throttled_cycles(i)
+		  << std::endl;
+	accepted += eval->get_ingress_flits_sent(i);
+	dropped += eval->get_flits_dropped(i);
+	throttled += eval->get_throttled_cycles(i);
+      }
+      std::cout << "Dropped flits: " << dropped << " of " << accepted + dropped << " offered" << std::endl
+		<< "Throttled cycles: " << throttled << std::endl;
+    }
+    if (request_response) {
+      request_response->print_results(std::cout);
+    }
+    if (adaptive) {
+      adaptive->print_results(std::cout);
+    }
+
+    // A sweep runs into saturation by design, so its requirements are
+    // not checked
+    bool error = false;
+    if (sweep) {
+      sweep->print_results(std::cout);
+      if (!params->sweep_file.empty()) {
+	std::ofstream sweep_file(params->sweep_file);
+	sweep->print_results(sweep_file);
+      }
+    } else {
+      if (min_throughput < params->required_throughput) {
+	std::cout << min_throughput << " < " << params->required_throughput << std::endl;
+	error = true;
+      }
+      if (median_latency > params->required_median_latency) {
+	std::cout << median_latency << " > " << params->required_median_latency << std::endl;
+	error = true;
+      }
+      if (max_latency > params->required_max_latency) {
+	std::cout << max_latency << " > " << params->required_max_latency << std::endl;
+	error = true;
+      }
+    }
+    if (!params->results_file.empty()) {
+      write_results_file(current_cycle, results, !error, false);
+    }
+    *success = !error;
+    *fatal = error;
+  }
 }
 
 extern "C" void egress_tick(long long int egress_id,
@@ -114,8 +724,7 @@ extern "C" void egress_tick(long long int egress_id,
 			    unsigned char* success,
 			    unsigned char* fatal
 			    ) {
-  if (!params) { init_params(std::string(config_str)); }
-  if (!eval) { init_eval(); }
+  init_once(config_str);
 
   // Only count received flits in measurement phase
   eval->egress_tick(egress_id,
@@ -129,79 +738,245 @@ extern "C" void egress_tick(long long int egress_id,
 		    params->in_measurement(current_cycle)
 		    );
 
-  *success = 0;
-  *fatal = 0;
-  if (egress_id == 0) {
-    if (params->timed_out(current_cycle)) {
-      std::cout << "Error, traffic eval timed out" << std::endl;
-      *fatal = 1;
-    } else if (params->in_drain(current_cycle) && eval->no_inflight_flits()) {
-      float min_throughput = std::numeric_limits<float>::max();
-      flow_rate_t* min_flow = NULL;
-      std::cout << "Results CSV:" << std::endl;
-      std::cout << "ingress_id, egress_id, received, sent, throughput, median_latency, max_latency" << std::endl;
-      std::map<uint64_t,uint64_t> aggregate_latency;
-      for (flow_rate_t& flow : params->flow_rates) {
-	uint64_t received = eval->get_flits_received(flow);
-	uint64_t sent = eval->get_flits_sent(flow);
-	float throughput = (float)received / (float)sent;
-	if (throughput < min_throughput || !min_flow) {
-	  min_throughput = throughput;
-	  min_flow = &flow;
-	}
-	uint64_t median_latency = eval->get_median_latency(flow);
-	uint64_t max_latency = eval->get_max_latency(flow);
-	std::cout << flow.ingress_id << ", "
-		  << flow.egress_id << ", "
-		  << received << ", "
-		  << sent << ", "
-		  << std::to_string(throughput) << ", "
-		  << median_latency << ", "
-		  << max_latency
-		  << std::endl;
-      }
-      uint64_t max_latency = eval->get_overall_max_latency();
-      uint64_t median_latency = eval->get_overall_median_latency();
-      std::cout << std::endl
-		<< "Min throughput: "
-		<< min_flow->ingress_id << ", "
-		<< min_flow->egress_id << ", "
-		<< min_throughput
-		<< std::endl
-		<< "Median latency: "
-		<< median_latency
-		<< std::endl
-		<< "Max latency: "
-		<< max_latency
-		<< std::endl
-		<< "Latency hist: ";
-      size_t bucket_size = 10;
-      for (uint64_t i = 0; i < max_latency; i += bucket_size) {
-	uint64_t c = 0;
-	for (uint64_t j = i; j < i + bucket_size; j++) {
-	  c += eval->get_overall_latency_count(j);
-	}
-	std::cout << "  " << i << "-" << i + bucket_size << ": " << c << std::endl;
-      }
+  *success = egress_id == 0 && eval_success.load(std::memory_order_relaxed);
+  *fatal = egress_id == 0 && eval_fatal.load(std::memory_order_relaxed);
+  finish_terminal_tick(current_cycle);
+}
 
-      bool error = false;
-      if (min_throughput < params->required_throughput) {
-	std::cout << min_throughput << " < " << params->required_throughput << std::endl;
-	error = true;
-      }
-      if (median_latency > params->required_median_latency) {
-	std::cout << median_latency << " > " << params->required_median_latency << std::endl;
-	error = true;
-      }
-      if (max_latency > params->required_max_latency) {
-	std::cout << max_latency << " > " << params->required_max_latency << std::endl;
-	error = true;
-      }
-      *success = !error;
-      *fatal = error;
+/*
+ * Returns the cycle of the next tick which can change the state of the
+ * evaluation. With no flits inflight, this is the next packet generated
+ * by the model, bounded by the next phase or batch boundary, where the
+ * boundary itself must be ticked to take effect.
+ */
+uint64_t get_next_tick_cycle(uint64_t current_cycle) {
+  uint64_t next = current_cycle + 1;
+  if (!params->fast_forward || !eval->no_inflight_flits() || params->in_drain(current_cycle)) {
+    return next;
+  }
+  uint64_t target = eval->next_event_cycle(current_cycle);
+  uint64_t boundaries[] = {
+    params->warmup_cycles,
+    params->warmup_cycles + params->measurement_cycles,
+    adaptive ? adaptive->get_next_batch_cycle() : std::numeric_limits<uint64_t>::max(),
+    telemetry ? telemetry->get_window_end_cycle() : std::numeric_limits<uint64_t>::max(),
+    params->checkpoint_save_file.empty() ? std::numeric_limits<uint64_t>::max() : params->checkpoint_save_cycle
+  };
+  for (uint64_t boundary : boundaries) {
+    if (boundary > current_cycle) {
+      target = std::min(target, boundary);
+    }
+  }
+  return std::max(target, next);
+}
+
+void save_checkpoint(const std::string& path, uint64_t current_cycle) {
+  checkpoint_writer_t ckpt(path);
+  checkpoint_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CHECKPOINT_MAGIC;
+  header.version = CHECKPOINT_VERSION;
+  header.model = get_traffic_model();
+  header.num_ingresses = params->num_ingresses;
+  header.num_egresses = params->num_egresses;
+  header.cycle = current_cycle;
+  ckpt.put(header);
+  eval->save(ckpt);
+  if (!ckpt.close()) {
+    std::cout << "Unable to write checkpoint " << path << std::endl;
+    exit(1);
+  }
+  std::cout << "Saved checkpoint of cycle " << current_cycle << " to " << path << std::endl;
+}
+
+static bool checkpoint_saved = false;
+bool checkpoint_save_due(uint64_t current_cycle) {
+  if (params->checkpoint_save_file.empty() || checkpoint_saved || current_cycle < params->checkpoint_save_cycle) {
+    return false;
+  }
+  if (!params->checkpoint_save_idle) {
+    checkpoint_saved = true;
+    return current_cycle == params->checkpoint_save_cycle;
+  }
+  if (eval->num_injected_flits() != eval->num_received_flits()) {
+    // The checkpoint must still precede measurement
+    if (current_cycle + 1 >= params->warmup_cycles) {
+      std::cout << "No warmup cycle from " << params->checkpoint_save_cycle
+		<< " has an empty network to save checkpoint " << params->checkpoint_save_file << std::endl;
+      exit(1);
+    }
+    return false;
+  }
+  checkpoint_saved = true;
+  return true;
+}
+
+uint64_t restore_checkpoint(const std::string& path) {
+  checkpoint_reader_t ckpt(path);
+  checkpoint_header_t header = ckpt.get<checkpoint_header_t>();
+  if (ckpt.fail() || header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION) {
+    std::cout << "Unable to read checkpoint " << path << std::endl;
+    exit(1);
+  }
+  if (header.model != (uint32_t)get_traffic_model() ||
+      header.num_ingresses != params->num_ingresses ||
+      header.num_egresses != params->num_egresses) {
+    std::cout << "Checkpoint " << path << " was saved by a different traffic model or network" << std::endl;
+    exit(1);
+  }
+  // Statistics are not saved, so the checkpoint must precede measurement
+  if (header.cycle >= params->warmup_cycles) {
+    std::cout << "Checkpoint " << path << " of cycle " << header.cycle
+	      << " is past the warmup of this run" << std::endl;
+    exit(1);
+  }
+  eval->restore(ckpt);
+  if (!ckpt.at_end()) {
+    std::cout << "Malformed checkpoint " << path << std::endl;
+    exit(1);
+  }
+  eval->count_inflight_flits();
+  std::cout << "Restored checkpoint of cycle " << header.cycle << " from " << path << std::endl;
+  return header.cycle;
+}
+
+#ifndef NO_DPI
+/*
+ * Batched alternative to ingress_tick/egress_tick, invoked once per cycle
+ * with open arrays covering every ingress and egress. This avoids a DPI
+ * crossing and config string marshal per terminal per cycle. Returns the
+ * cycle of the next tick in next_cycle, which skips idle cycles when
+ * fast_forward is set.
+ */
+extern "C" void traffic_tick(const char* config_str,
+			     long long int current_cycle,
+			     const svOpenArrayHandle flit_out_ready,
+			     const svOpenArrayHandle flit_out_valid,
+			     const svOpenArrayHandle flit_out_head,
+			     const svOpenArrayHandle flit_out_tail,
+			     const svOpenArrayHandle flit_out_egress_id,
+			     const svOpenArrayHandle flit_out_unique_id,
+			     const svOpenArrayHandle flit_in_ready,
+			     const svOpenArrayHandle flit_in_valid,
+			     const svOpenArrayHandle flit_in_head,
+			     const svOpenArrayHandle flit_in_tail,
+			     const svOpenArrayHandle flit_in_ingress_id,
+			     const svOpenArrayHandle flit_in_unique_id,
+			     unsigned char* success,
+			     unsigned char* fatal,
+			     long long int* next_cycle
+			     ) {
+  init_once(config_str);
+
+  bool gen_packets = !params->in_drain(current_cycle);
+  bool in_measurement = params->in_measurement(current_cycle);
+  int num_ingresses = svSize(flit_out_ready, 1);
+  int num_egresses = svSize(flit_in_ready, 1);
+
+  // A simulator restored without its own checkpoint starts from cycle 0
+  // with an empty network, so it idles until the checkpoint's cycle, and
+  // can only resume a checkpoint with no flits in the network
+  if ((uint64_t)current_cycle < params->resume_cycle) {
+    for (int i = 0; i < num_ingresses; i++) {
+      svPutBitArrElem1(flit_out_valid, 0, i);
+    }
+    for (int i = 0; i < num_egresses; i++) {
+      svPutBitArrElem1(flit_in_ready, 1, i);
+    }
+    uint64_t network_flits = eval->num_injected_flits() - eval->num_received_flits();
+    if (network_flits > 0) {
+      std::cout << "Checkpoint " << params->checkpoint_restore_file << " holds " << network_flits
+		<< " flits in the network, which requires restoring the simulator's state with it" << std::endl;
+    }
+    *success = false;
+    *fatal = network_flits > 0;
+    *next_cycle = params->fast_forward ? params->resume_cycle : current_cycle + 1;
+    return;
+  }
+
+  for (int i = 0; i < num_ingresses; i++) {
+    flit_t* flit_to_send = eval->ingress_tick(i,
+					      current_cycle,
+					      svGetBitArrElem1(flit_out_ready, i),
+					      gen_packets,
+					      in_measurement);
+    svPutBitArrElem1(flit_out_valid, flit_to_send != NULL, i);
+    if (flit_to_send) {
+      svPutBitArrElem1(flit_out_head, flit_to_send->head, i);
+      svPutBitArrElem1(flit_out_tail, flit_to_send->tail, i);
+      *(long long int*)svGetArrElemPtr1(flit_out_egress_id, i) = flit_to_send->egress_id;
+      *(long long int*)svGetArrElemPtr1(flit_out_unique_id, i) = flit_to_send->unique_id;
+    }
+  }
+
+  for (int i = 0; i < num_egresses; i++) {
+    bool ready;
+    eval->egress_tick(i,
+		      &ready,
+		      svGetBitArrElem1(flit_in_valid, i),
+		      svGetBitArrElem1(flit_in_head, i),
+		      svGetBitArrElem1(flit_in_tail, i),
+		      *(long long int*)svGetArrElemPtr1(flit_in_ingress_id, i),
+		      *(long long int*)svGetArrElemPtr1(flit_in_unique_id, i),
+		      current_cycle,
+		      in_measurement
+		      );
+    svPutBitArrElem1(flit_in_ready, ready, i);
+  }
+
+  if (checkpoint_save_due(current_cycle)) {
+    save_checkpoint(params->checkpoint_save_file, current_cycle);
+  }
+  check_eval_done(current_cycle, success, fatal);
+  *next_cycle = get_next_tick_cycle(current_cycle);
+}
+
+/*
+ * Accumulates one cycle of the routers' counters into router_stats. The
+ * layout string describes the links, as for router_stats_t. link_flits
+ * holds the flits which crossed each link, va_stall and sa_stall the
+ * virtual channel and switch allocation stalls of each input port, and
+ * occupancy the flits buffered in each input virtual channel.
+ */
+static std::once_flag router_stats_flag;
+extern "C" void router_stats_tick(const char* config_str,
+				  const char* layout_str,
+				  long long int current_cycle,
+				  const svOpenArrayHandle link_flits,
+				  const svOpenArrayHandle va_stall,
+				  const svOpenArrayHandle sa_stall,
+				  const svOpenArrayHandle occupancy
+				  ) {
+  init_once(config_str);
+  std::call_once(router_stats_flag, [&] {
+    init_router_stats(std::string(layout_str));
+    if (router_stats && (svSize(link_flits, 1) != (int)router_stats->num_links() ||
+			 svSize(va_stall, 1) != (int)router_stats->num_inputs() ||
+			 svSize(occupancy, 1) != (int)router_stats->num_vcs())) {
+      std::cout << "Router stats layout does not match the counters" << std::endl;
+      exit(1);
     }
+  });
+  if (!router_stats) {
+    return;
+  }
+
+  int num_links = svSize(link_flits, 1);
+  int num_inputs = svSize(va_stall, 1);
+  int num_vcs = svSize(occupancy, 1);
+  std::lock_guard<std::mutex> lock(router_stats->lock);
+  for (int i = 0; i < num_links; i++) {
+    router_stats->add_flits(i, *(int*)svGetArrElemPtr1(link_flits, i));
   }
+  for (int i = 0; i < num_inputs; i++) {
+    router_stats->add_stalls(i, *(int*)svGetArrElemPtr1(va_stall, i), *(int*)svGetArrElemPtr1(sa_stall, i));
+  }
+  for (int i = 0; i < num_vcs; i++) {
+    router_stats->add_occupancy(i, *(int*)svGetArrElemPtr1(occupancy, i));
+  }
+  router_stats->tick(current_cycle);
 }
+#endif
 
 /*
  * Construct a runtime_params_t object from a config string
@@ -211,6 +986,7 @@ extern "C" void egress_tick(long long int egress_id,
  *  measurement             10000
  *  drain                   100000
  *  flits_per_packet        4
+ *  seed                    0
  *  required_throughput     1.0
  *  required_median_latency 99999
  *  required_max_latency    99999
@@ -218,9 +994,129 @@ extern "C" void egress_tick(long long int egress_id,
  *  netrace_trace           blackscholes_64c_simsmall.tra.bz2
  *  netrace_region          0
  *  netrace_ignore_dependencies false
+ *  netrace_prefetch        4096
+ *  num_ingresses    2
+ *  num_egresses     2
  *  flow             0 0 0.5
  *  flow             0 1 0.5
+ *
+ * Instead of flows, a synthetic pattern can be given, along with the
+ * number of ingresses and egresses:
+ *
+ *  pattern          uniform 0.5
+ *  pattern          hotspot 0.5 <hotspot_fraction> <egress_id> ...
+ *  pattern_radix    4
+ *
+ * The injection process and packet size distribution can be set for all
+ * flows, and overridden per flow:
+ *
+ *  injection_process bernoulli
+ *  injection_process onoff  <mean_burst_packets>
+ *  injection_process pareto <alpha> <mean_burst_packets>
+ *  packet_size       fixed   <flits>
+ *  packet_size       uniform <min_flits> <max_flits>
+ *  packet_size       bimodal <flits_a> <flits_b> <probability_a>
+ *  flow_process      0 1 onoff 8
+ *  flow_packet_size  0 1 bimodal 1 9 0.5
+ *
+ * Flows can be split into traffic classes, named by an optional last
+ * argument of flow, each with its own injection process and packet size,
+ * and reported separately. Flow overrides take precedence over the class:
+ *
+ *  traffic_class     <name>
+ *  class_process     <name> onoff 8
+ *  class_packet_size <name> fixed 1
+ *  flow              0 1 0.5 <name>
+ *
+ * A load sweep scales all rates from start to stop in steps, within one run:
+ *
+ *  sweep                0.2 2.0 0.2
+ *  sweep_settle         1000
+ *  sweep_saturation     <latency_factor> <min_accepted_fraction>
+ *  sweep_file           sweep.csv
+ *
+ * Adaptive phases end warmup and measurement early, once the network is
+ * in steady-state and the results are precise enough:
+ *
+ *  adaptive             <batch_cycles> <relative_ci_width>
+ *  adaptive_confidence  0.95
+ *  adaptive_min_batches 10
+ *
+ * The batched harness skips idle cycles with:
+ *
+ *  fast_forward         true
+ *
+ * The traffic state can be saved at the end of a warmup cycle, and a run
+ * resumed from it, along with the simulator's own saved state:
+ *
+ *  checkpoint_save      <cycle> <file>
+ *  checkpoint_restore   <file>
+ *
+ * With idle, the save waits for the first cycle from <cycle> with no
+ * flits in the network, which a fresh simulator can resume:
+ *
+ *  checkpoint_save      <cycle> <file> idle
+ *
+ * Harnesses which report the routers' counters write them as a per-link
+ * heatmap every window with:
+ *
+ *  router_stats         <window> <file>
  */
+
+// Parses the injection process in argv[start:]
+static injection_process_t parse_injection_process(std::vector<std::string>& argv, size_t start) {
+  injection_process_t process;
+  process.kind = injection_process_t::BERNOULLI;
+  process.mean_burst = 1.0f;
+  process.alpha = 0.0f;
+  assert(argv.size() > start);
+  if (argv[start] == "bernoulli") {
+    assert(argv.size() == start + 1);
+  } else if (argv[start] == "onoff") {
+    assert(argv.size() == start + 2);
+    process.kind = injection_process_t::ONOFF;
+    process.mean_burst = stof(argv[start + 1]);
+  } else if (argv[start] == "pareto") {
+    assert(argv.size() == start + 3);
+    process.kind = injection_process_t::PARETO;
+    process.alpha = stof(argv[start + 1]);
+    process.mean_burst = stof(argv[start + 2]);
+    assert(process.alpha > 1.0f);
+  } else {
+    std::cout << "Unknown injection process " << argv[start] << std::endl;
+    exit(1);
+  }
+  assert(process.mean_burst >= 1.0f);
+  return process;
+}
+
+// Parses the packet size distribution in argv[start:]
+static packet_size_t parse_packet_size(std::vector<std::string>& argv, size_t start) {
+  packet_size_t size;
+  size.kind = packet_size_t::FIXED;
+  size.prob_min = 1.0f;
+  assert(argv.size() > start + 1);
+  size.min = stoi(argv[start + 1]);
+  size.max = size.min;
+  if (argv[start] == "fixed") {
+    assert(argv.size() == start + 2);
+  } else if (argv[start] == "uniform") {
+    assert(argv.size() == start + 3);
+    size.kind = packet_size_t::UNIFORM;
+    size.max = stoi(argv[start + 2]);
+  } else if (argv[start] == "bimodal") {
+    assert(argv.size() == start + 4);
+    size.kind = packet_size_t::BIMODAL;
+    size.max = stoi(argv[start + 2]);
+    size.prob_min = stof(argv[start + 3]);
+  } else {
+    std::cout << "Unknown packet size distribution " << argv[start] << std::endl;
+    exit(1);
+  }
+  assert(size.min >= 1 && size.max >= 1 && (size.kind == packet_size_t::BIMODAL || size.min <= size.max));
+  return size;
+}
+
 runtime_params_t::runtime_params_t(std::vector<std::string> args) {
   this->warmup_cycles = 1000;
   this->measurement_cycles = 2000;
@@ -234,6 +1130,43 @@ runtime_params_t::runtime_params_t(std::vector<std::string> args) {
   this->netrace_enable = false;
   this->netrace_trace = "blackscholes_64c_simsmall.tra.bz2";
   this->netrace_ignore_dependencies = false;
+  this->netrace_prefetch = 4096;
+  this->pattern_rate = 0.0f;
+  this->pattern_radix = 0;
+  this->hotspot_fraction = 0.0f;
+  this->sweep_enable = false;
+  this->sweep_settle_cycles = 1000;
+  this->sweep_latency_factor = 10.0f;
+  this->sweep_min_accepted = 0.9f;
+  this->adaptive_enable = false;
+  this->adaptive_confidence = 0.95f;
+  this->adaptive_min_batches = 10;
+  this->fast_forward = false;
+  this->telemetry_window = 0;
+  this->telemetry_binary = false;
+  this->router_stats_window = 0;
+  this->packet_stats = false;
+  this->source_queue_limit = 0;
+  this->source_queue_throttle = false;
+  this->watchdog_cycles = 0;
+  this->checkpoint_save_cycle = 0;
+  this->checkpoint_save_idle = false;
+  this->resume_cycle = 0;
+  this->request_window = 0;
+  this->reply_flits = 0;
+  this->service_latency = 0;
+  this->seed = 0;
+  this->injection_process.kind = injection_process_t::BERNOULLI;
+  this->injection_process.mean_burst = 1.0f;
+  this->injection_process.alpha = 0.0f;
+  bool packet_size_set = false;
+  std::map<std::pair<uint64_t, uint64_t>, injection_process_t> flow_processes;
+  std::map<std::pair<uint64_t, uint64_t>, packet_size_t> flow_packet_sizes;
+  this->traffic_classes.push_back("default");
+  std::map<std::string, injection_process_t> class_processes;
+  std::map<std::string, packet_size_t> class_packet_sizes;
+  // Class of each flow, resolved once every class is declared
+  std::vector<std::string> flow_classes;
 
   for (std::string arg : args) {
     std::istringstream ss(arg);
@@ -274,68 +1207,624 @@ runtime_params_t::runtime_params_t(std::vector<std::string> args) {
     } else if (flag == "netrace_ignore_dependencies") {
       assert(argv.size() == 2);
       this->netrace_ignore_dependencies = argv[1] == "true";
+    } else if (flag == "netrace_prefetch") {
+      assert(argv.size() == 2);
+      this->netrace_prefetch = stoi(argv[1]);
     } else if (flag == "netrace_region") {
       assert(argv.size() == 2);
       this->netrace_region = stoi(argv[1]);
-    } else if (flag == "flow") {
-      assert(argv.size() == 4);
-      flow_rate_t new_flow;
-      new_flow.ingress_id = stoi(argv[1]);
-      new_flow.egress_id = stoi(argv[2]);
-      this->num_ingresses = std::max(this->num_ingresses, new_flow.ingress_id + 1);
-      this->num_egresses = std::max(this->num_egresses, new_flow.egress_id + 1);
-      new_flow.rate = stof(argv[3]);
-      this->flow_rates.push_back(new_flow);
-    } else {
-      std::cout << "Error parsing config" << std::endl;
-      for (std::string& s : args) {
-	std::cout << s << std::endl;
+    } else if (flag == "num_ingresses") {
+      assert(argv.size() == 2);
+      this->num_ingresses = std::max(this->num_ingresses, (uint64_t)stoi(argv[1]));
+    } else if (flag == "num_egresses") {
+      assert(argv.size() == 2);
+      this->num_egresses = std::max(this->num_egresses, (uint64_t)stoi(argv[1]));
+    } else if (flag == "pattern") {
+      assert(argv.size() >= 3);
+      this->pattern = argv[1];
+      this->pattern_rate = stof(argv[2]);
+      if (this->pattern == "hotspot") {
+	assert(argv.size() >= 5);
+	this->hotspot_fraction = stof(argv[3]);
+	for (size_t i = 4; i < argv.size(); i++) {
+	  this->hotspot_egresses.push_back(stoi(argv[i]));
+	}
+      } else {
+	assert(argv.size() == 3);
       }
-      exit(1);
-    }
+    } else if (flag == "injection_process") {
+      this->injection_process = parse_injection_process(argv, 1);
+    } else if (flag == "packet_size") {
+      this->packet_size = parse_packet_size(argv, 1);
+      packet_size_set = true;
+    } else if (flag == "flow_process") {
+      assert(argv.size() >= 4);
+      flow_processes[std::make_pair(stoi(argv[1]), stoi(argv[2]))] = parse_injection_process(argv, 3);
+    } else if (flag == "flow_packet_size") {
+      assert(argv.size() >= 5);
+      flow_packet_sizes[std::make_pair(stoi(argv[1]), stoi(argv[2]))] = parse_packet_size(argv, 3);
+    } else if (flag == "traffic_class") {
+      assert(argv.size() == 2);
+      if (std::count(this->traffic_classes.begin(), this->traffic_classes.end(), argv[1])) {
+	std::cout << "Duplicate traffic class " << argv[1] << std::endl;
+	exit(1);
+      }
+      this->traffic_classes.push_back(argv[1]);
+    } else if (flag == "class_process") {
+      assert(argv.size() >= 3);
+      class_processes[argv[1]] = parse_injection_process(argv, 2);
+    } else if (flag == "class_packet_size") {
+      assert(argv.size() >= 4);
+      class_packet_sizes[argv[1]] = parse_packet_size(argv, 2);
+    } else if (flag == "sweep") {
+      assert(argv.size() == 4);
+      this->sweep_enable = true;
+      this->sweep_start = stof(argv[1]);
+      this->sweep_stop = stof(argv[2]);
+      this->sweep_step = stof(argv[3]);
+      assert(this->sweep_start > 0.0f && this->sweep_step > 0.0f);
+    } else if (flag == "sweep_settle") {
+      assert(argv.size() == 2);
+      this->sweep_settle_cycles = stoi(argv[1]);
+    } else if (flag == "sweep_saturation") {
+      assert(argv.size() == 3);
+      this->sweep_latency_factor = stof(argv[1]);
+      this->sweep_min_accepted = stof(argv[2]);
+    } else if (flag == "sweep_file") {
+      assert(argv.size() == 2);
+      this->sweep_file = argv[1];
+    } else if (flag == "adaptive") {
+      assert(argv.size() == 3);
+      this->adaptive_enable = true;
+      this->adaptive_batch_cycles = stoi(argv[1]);
+      this->adaptive_rel_width = stof(argv[2]);
+      assert(this->adaptive_batch_cycles > 0);
+    } else if (flag == "adaptive_confidence") {
+      assert(argv.size() == 2);
+      this->adaptive_confidence = stof(argv[1]);
+      assert(this->adaptive_confidence > 0.0f && this->adaptive_confidence < 1.0f);
+    } else if (flag == "adaptive_min_batches") {
+      assert(argv.size() == 2);
+      this->adaptive_min_batches = stoi(argv[1]);
+      assert(this->adaptive_min_batches >= 2);
+    } else if (flag == "seed") {
+      assert(argv.size() == 2);
+      this->seed = std::stoull(argv[1]);
+    } else if (flag == "fast_forward") {
+      assert(argv.size() == 2);
+      this->fast_forward = argv[1] == "true";
+    } else if (flag == "telemetry") {
+      assert(argv.size() == 3);
+      this->telemetry_window = stoi(argv[1]);
+      this->telemetry_file = argv[2];
+      assert(this->telemetry_window > 0);
+    } else if (flag == "router_stats") {
+      assert(argv.size() == 3);
+      this->router_stats_window = std::stoull(argv[1]);
+      this->router_stats_file = argv[2];
+      assert(this->router_stats_window > 0);
+    } else if (flag == "packet_stats") {
+      assert(argv.size() == 2);
+      this->packet_stats = argv[1] == "true";
+    } else if (flag == "checkpoint_save") {
+      assert(argv.size() == 3 || (argv.size() == 4 && argv[3] == "idle"));
+      this->checkpoint_save_cycle = std::stoull(argv[1]);
+      this->checkpoint_save_file = argv[2];
+      this->checkpoint_save_idle = argv.size() == 4;
+    } else if (flag == "checkpoint_restore") {
+      assert(argv.size() == 2);
+      this->checkpoint_restore_file = argv[1];
+    } else if (flag == "watchdog") {
+      assert(argv.size() == 2);
+      this->watchdog_cycles = std::stoull(argv[1]);
+    } else if (flag == "source_queue") {
+      assert(argv.size() == 3 && (argv[2] == "drop" || argv[2] == "throttle"));
+      this->source_queue_limit = std::stoull(argv[1]);
+      this->source_queue_throttle = argv[2] == "throttle";
+      assert(this->source_queue_limit > 0);
+    } else if (flag == "request_response") {
+      assert(argv.size() == 4);
+      this->request_window = std::stoull(argv[1]);
+      this->reply_flits = std::stoull(argv[2]);
+      this->service_latency = std::stoull(argv[3]);
+      assert(this->request_window > 0 && this->reply_flits > 0);
+    } else if (flag == "results_file") {
+      assert(argv.size() == 2);
+      this->results_file = argv[1];
+    } else if (flag == "telemetry_format") {
+      assert(argv.size() == 2 && (argv[1] == "csv" || argv[1] == "binary"));
+      this->telemetry_binary = argv[1] == "binary";
+    } else if (flag == "pattern_radix") {
+      assert(argv.size() == 2);
+      this->pattern_radix = stoi(argv[1]);
+    } else if (flag == "flow") {
+      assert(argv.size() == 4 || argv.size() == 5);
+      flow_rate_t new_flow;
+      new_flow.ingress_id = stoi(argv[1]);
+      new_flow.egress_id = stoi(argv[2]);
+      this->num_ingresses = std::max(this->num_ingresses, new_flow.ingress_id + 1);
+      this->num_egresses = std::max(this->num_egresses, new_flow.egress_id + 1);
+      new_flow.rate = stof(argv[3]);
+      this->flow_rates.push_back(new_flow);
+      flow_classes.push_back(argv.size() == 5 ? argv[4] : this->traffic_classes[0]);
+    } else {
+      std::cout << "Error parsing config" << std::endl;
+      for (std::string& s : args) {
+	std::cout << s << std::endl;
+      }
+      exit(1);
+    }
+  }
+
+  // Resolve the injection process and packet size of each flow
+  if (!packet_size_set) {
+    this->packet_size.kind = packet_size_t::FIXED;
+    this->packet_size.min = this->flits_per_packet;
+    this->packet_size.max = this->flits_per_packet;
+    this->packet_size.prob_min = 1.0f;
   }
-  if (this->flow_rates.size() == 0 && !this->netrace_enable) {
+  auto class_index = [&](const std::string& name) -> uint64_t {
+    auto c = std::find(this->traffic_classes.begin(), this->traffic_classes.end(), name);
+    if (c == this->traffic_classes.end()) {
+      std::cout << "Unknown traffic class " << name << std::endl;
+      exit(1);
+    }
+    return c - this->traffic_classes.begin();
+  };
+  for (auto& process : class_processes) {
+    class_index(process.first);
+  }
+  for (auto& size : class_packet_sizes) {
+    class_index(size.first);
+  }
+  for (size_t f = 0; f < this->flow_rates.size(); f++) {
+    flow_rate_t& flow = this->flow_rates[f];
+    const std::string& name = flow_classes[f];
+    flow.traffic_class = class_index(name);
+    // Flow overrides take precedence over the class, and the class over
+    // the defaults
+    std::pair<uint64_t, uint64_t> key(flow.ingress_id, flow.egress_id);
+    flow.process = (flow_processes.count(key) ? flow_processes[key] :
+		    class_processes.count(name) ? class_processes[name] : this->injection_process);
+    flow.size = (flow_packet_sizes.count(key) ? flow_packet_sizes[key] :
+		 class_packet_sizes.count(name) ? class_packet_sizes[name] : this->packet_size);
+  }
+
+  if (this->flow_rates.size() == 0 && this->pattern.empty() && !this->netrace_enable) {
     std::cout << "Must specify at least one flow" << std::endl;
     exit(1);
   }
+  if (!this->pattern.empty() && (this->num_ingresses == 0 || this->num_egresses == 0)) {
+    std::cout << "Traffic patterns require num_ingresses and num_egresses" << std::endl;
+    exit(1);
+  }
+  if (this->traffic_classes.size() > 1 && this->flow_rates.size() == 0) {
+    std::cout << "Traffic classes require explicit flows" << std::endl;
+    exit(1);
+  }
+  if (this->sweep_enable && this->netrace_enable) {
+    std::cout << "Load sweeps are not supported with netrace traces" << std::endl;
+    exit(1);
+  }
+  if (this->sweep_enable && this->adaptive_enable) {
+    std::cout << "Load sweeps and adaptive phases cannot be combined" << std::endl;
+    exit(1);
+  }
+  // Checkpoints hold no statistics, so they are taken in warmup, whose
+  // end adaptive phases would decide from the warmup batches
+  bool checkpoints = !this->checkpoint_save_file.empty() || !this->checkpoint_restore_file.empty();
+  if (checkpoints && this->adaptive_enable) {
+    std::cout << "Checkpoints are not supported with adaptive phases" << std::endl;
+    exit(1);
+  }
+  if (!this->checkpoint_save_file.empty() && this->checkpoint_save_cycle >= this->warmup_cycles) {
+    std::cout << "checkpoint_save must be a warmup cycle" << std::endl;
+    exit(1);
+  }
 }
 
 traffic_eval_t::traffic_eval_t(runtime_params_t *params) {
   this->flits_per_packet = params->flits_per_packet;
+  this->seed = params->seed;
+  this->source_queue_limit = params->source_queue_limit;
+  this->source_queue_throttle = params->source_queue_throttle;
   this->num_ingresses = params->num_ingresses;
   this->num_egresses = params->num_egresses;
-  this->inflight_flits = std::map<uint64_t,flit_t*>();
-  this->unique_flit_id = 0;
-  this->total_flits_received = 0;
-  for (size_t i = 0; i < params->num_ingresses; i++) {
-    this->ingress_queues.push_back(std::queue<flit_t*>());
-    this->flits_received.push_back(std::vector<uint64_t>());
-    this->flits_sent.push_back(std::vector<uint64_t>());
-    this->latencies_by_flow.push_back(std::vector<std::map<uint64_t,uint64_t>>());
-    for (size_t j = 0; j < params->num_egresses; j++) {
-      this->flits_received[i].push_back(0);
-      this->flits_sent[i].push_back(0);
-      this->latencies_by_flow[i].push_back(std::map<uint64_t,uint64_t>());
-    }
-  }
-}
-
-uint64_t traffic_eval_t::inject_flits_for_packet(uint64_t ingress_id, uint64_t egress_id,
-						 bool count_injected_flits,
-						 uint64_t current_cycle) {
-  uint64_t tail_unique_id;
-  for (uint64_t f = 0; f < this->flits_per_packet; f++) {
-    uint64_t unique_id = this->get_new_unique_flit_id();
-    flit_t *flit = new flit_t(f == 0, f + 1 == this->flits_per_packet,
-			      ingress_id, egress_id, unique_id, current_cycle);
-    this->inflight_flits[unique_id] = flit;
-    tail_unique_id = unique_id;
-    this->ingress_queues[ingress_id].push(flit);
+  this->num_classes = params->traffic_classes.size();
+  // Shards are never moved after construction, since they hold atomics
+  this->ingress_shards = std::vector<ingress_shard_t>(params->num_ingresses);
+  this->egress_shards = std::vector<egress_shard_t>(params->num_egresses);
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    ingress_shard_t& shard = this->ingress_shards[i];
+    shard.flits_sent.assign(this->num_egresses, 0);
+    if (this->num_classes > 1) {
+      shard.flits_sent_by_class.assign(this->num_classes, 0);
+    }
+    shard.num_generated = 0;
+    shard.num_flushed = 0;
+    shard.num_injected = 0;
+    shard.head_departure_cycle = 0;
+    shard.front_flits_sent = 0;
+    shard.flits_dropped = 0;
+    shard.throttled_cycles = 0;
+  }
+  for (egress_shard_t& shard : this->egress_shards) {
+    shard.flits_received.assign(this->num_ingresses, 0);
+    shard.latencies_by_ingress.resize(this->num_ingresses);
+    if (params->packet_stats) {
+      shard.packet_latencies_by_ingress.resize(this->num_ingresses);
+    }
+    if (this->num_classes > 1) {
+      shard.flits_received_by_class.assign(this->num_classes, 0);
+      shard.latencies_by_class.resize(this->num_classes);
+      if (params->packet_stats) {
+	shard.packet_latencies_by_class.resize(this->num_classes);
+      }
+    }
+    shard.num_received = 0;
+  }
+  this->inflight_flits = 0;
+  this->telemetry_enabled = false;
+  this->packet_stats = params->packet_stats;
+  this->reset_window_stats();
+}
+
+const latency_hist_t<uint64_t>& traffic_eval_t::get_overall_latencies() {
+  this->latencies.clear();
+  for (egress_shard_t& shard : this->egress_shards) {
+    this->latencies.merge(shard.latencies);
+  }
+  return this->latencies;
+}
+
+const packet_latencies_t<uint64_t>& traffic_eval_t::get_overall_packet_latencies() {
+  this->packet_latencies.clear();
+  for (egress_shard_t& shard : this->egress_shards) {
+    this->packet_latencies.merge(shard.packet_latencies);
+  }
+  return this->packet_latencies;
+}
+
+uint64_t traffic_eval_t::get_class_flits_sent(uint64_t traffic_class) {
+  uint64_t sent = 0;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    sent += shard.flits_sent_by_class[traffic_class];
   }
+  return sent;
+}
+
+uint64_t traffic_eval_t::get_class_flits_received(uint64_t traffic_class) {
+  uint64_t received = 0;
+  for (egress_shard_t& shard : this->egress_shards) {
+    received += shard.flits_received_by_class[traffic_class];
+  }
+  return received;
+}
+
+const latency_hist_t<uint64_t>& traffic_eval_t::get_class_latencies(uint64_t traffic_class) {
+  this->class_latencies.clear();
+  for (egress_shard_t& shard : this->egress_shards) {
+    this->class_latencies.merge(shard.latencies_by_class[traffic_class]);
+  }
+  return this->class_latencies;
+}
+
+const packet_latencies_t<uint64_t>& traffic_eval_t::get_class_packet_latencies(uint64_t traffic_class) {
+  this->class_packet_latencies.clear();
+  for (egress_shard_t& shard : this->egress_shards) {
+    this->class_packet_latencies.merge(shard.packet_latencies_by_class[traffic_class]);
+  }
+  return this->class_packet_latencies;
+}
+
+uint64_t traffic_eval_t::get_window_flits_sent() {
+  uint64_t sent = 0;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    sent += shard.window_flits_sent;
+  }
+  return sent;
+}
+
+uint64_t traffic_eval_t::get_window_flits_received() {
+  uint64_t received = 0;
+  for (egress_shard_t& shard : this->egress_shards) {
+    received += shard.window_flits_received;
+  }
+  return received;
+}
+
+const latency_hist_t<uint64_t>& traffic_eval_t::get_window_latencies() {
+  this->window_latencies.clear();
+  for (egress_shard_t& shard : this->egress_shards) {
+    this->window_latencies.merge(shard.window_latencies);
+  }
+  return this->window_latencies;
+}
+
+void traffic_eval_t::reset_window_stats() {
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    shard.window_flits_sent = 0;
+  }
+  for (egress_shard_t& shard : this->egress_shards) {
+    shard.window_flits_received = 0;
+    shard.window_latencies.clear();
+  }
+}
+
+uint64_t traffic_eval_t::num_generated_flits() {
+  uint64_t generated = 0;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    generated += shard.num_generated.load(std::memory_order_relaxed);
+  }
+  return generated;
+}
+
+void traffic_eval_t::count_inflight_flits() {
+  uint64_t inflight = 0;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    inflight += shard.num_generated.load(std::memory_order_relaxed);
+    inflight -= shard.num_flushed.load(std::memory_order_relaxed);
+  }
+  for (egress_shard_t& shard : this->egress_shards) {
+    inflight -= shard.num_received.load(std::memory_order_relaxed);
+  }
+  this->inflight_flits.store(inflight, std::memory_order_relaxed);
+}
+
+uint64_t traffic_eval_t::num_queued_flits() {
+  uint64_t queued = 0;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    queued += shard.num_generated.load(std::memory_order_relaxed);
+    queued -= shard.num_flushed.load(std::memory_order_relaxed);
+    queued -= shard.num_injected.load(std::memory_order_relaxed);
+  }
+  return queued;
+}
+
+uint64_t traffic_eval_t::num_injected_flits() {
+  uint64_t injected = 0;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    injected += shard.num_injected.load(std::memory_order_relaxed);
+  }
+  return injected;
+}
+
+uint64_t traffic_eval_t::num_received_flits() {
+  uint64_t received = 0;
+  for (egress_shard_t& shard : this->egress_shards) {
+    received += shard.num_received.load(std::memory_order_relaxed);
+  }
+  return received;
+}
+
+const latency_hist_t<uint64_t>& traffic_eval_t::get_telemetry_latencies() {
+  this->telemetry_latencies.clear();
+  for (egress_shard_t& shard : this->egress_shards) {
+    this->telemetry_latencies.merge(shard.telemetry_latencies);
+  }
+  return this->telemetry_latencies;
+}
+
+void traffic_eval_t::reset_telemetry_latencies() {
+  for (egress_shard_t& shard : this->egress_shards) {
+    shard.telemetry_latencies.clear();
+  }
+}
+
+std::vector<flow_rate_t> traffic_eval_t::get_active_flows() {
+  std::vector<flow_rate_t> flows;
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    for (uint64_t e = 0; e < this->num_egresses; e++) {
+      if (this->ingress_shards[i].flits_sent[e] > 0 || this->egress_shards[e].flits_received[i] > 0) {
+	flow_rate_t flow = flow_rate_t();
+	flow.ingress_id = i;
+	flow.egress_id = e;
+	flow.rate = 0.0f;
+	flows.push_back(flow);
+      }
+    }
+  }
+  return flows;
+}
+
+void traffic_eval_t::inject_flits_for_packet(uint64_t ingress_id, uint64_t egress_id,
+					     uint64_t num_flits,
+					     bool count_injected_flits,
+					     uint64_t current_cycle,
+					     uint64_t tag,
+					     uint64_t traffic_class) {
+  ingress_shard_t& shard = this->ingress_shards[ingress_id];
+  if (this->source_queue_limit > 0 && shard.queue.size() >= this->source_queue_limit) {
+    // Throttled generators stop before filling the queue, so this drops
+    if (count_injected_flits) {
+      shard.flits_dropped += num_flits;
+      shard.window_flits_sent += num_flits;
+    }
+    return;
+  }
+  // The flits are created as they are dequeued
+  shard.queue.push({egress_id, num_flits, current_cycle, tag, traffic_class});
+  shard.num_generated.store(shard.num_generated.load(std::memory_order_relaxed) + num_flits,
+			    std::memory_order_relaxed);
   if (count_injected_flits) {
-    this->flits_sent[ingress_id][egress_id] += this->flits_per_packet;
+    shard.flits_sent[egress_id] += num_flits;
+    shard.window_flits_sent += num_flits;
+    if (this->num_classes > 1) {
+      shard.flits_sent_by_class[traffic_class] += num_flits;
+    }
+  }
+}
+
+bool traffic_eval_t::get_oldest_network_flit(flit_t& flit) {
+  bool found = false;
+  flit_t oldest;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    if (shard.flits.oldest_live(oldest) &&
+	(!found || oldest.head_departure_cycle < flit.head_departure_cycle)) {
+      flit = oldest;
+      found = true;
+    }
+  }
+  return found;
+}
+
+std::vector<flit_t> traffic_eval_t::get_network_flits() {
+  std::vector<flit_t> flits;
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    shard.flits.live_flits(flits);
+  }
+  return flits;
+}
+
+uint64_t traffic_eval_t::get_queued_flits(uint64_t ingress_id) {
+  ingress_shard_t& shard = this->ingress_shards[ingress_id];
+  return (shard.num_generated.load(std::memory_order_relaxed) -
+	  shard.num_flushed.load(std::memory_order_relaxed) -
+	  shard.num_injected.load(std::memory_order_relaxed));
+}
+
+uint64_t traffic_eval_t::get_ingress_flits_sent(uint64_t ingress_id) {
+  const std::vector<uint64_t>& sent = this->ingress_shards[ingress_id].flits_sent;
+  return std::accumulate(sent.begin(), sent.end(), (uint64_t)0);
+}
+
+void traffic_eval_t::set_load_scale(float) {
+  std::cout << "Load scaling is not supported by this traffic model" << std::endl;
+  exit(1);
+}
+
+void traffic_eval_t::flush_ingress_queues() {
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    // A packet partway into the network must still be sent
+    ring_queue_t<queued_packet_t> kept;
+    if (!shard.queue.empty() && shard.front_flits_sent > 0) {
+      kept.push(shard.queue.front());
+      shard.queue.pop();
+    }
+    uint64_t flushed = 0;
+    while (!shard.queue.empty()) {
+      flushed += shard.queue.front().num_flits;
+      shard.queue.pop();
+    }
+    shard.queue = kept;
+    shard.num_flushed.store(shard.num_flushed.load(std::memory_order_relaxed) + flushed,
+			    std::memory_order_relaxed);
+  }
+}
+
+void traffic_eval_t::reset_stats() {
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    std::fill(shard.flits_sent.begin(), shard.flits_sent.end(), 0);
+    std::fill(shard.flits_sent_by_class.begin(), shard.flits_sent_by_class.end(), 0);
+    shard.flits_dropped = 0;
+    shard.throttled_cycles = 0;
+  }
+  for (egress_shard_t& shard : this->egress_shards) {
+    std::fill(shard.flits_received.begin(), shard.flits_received.end(), 0);
+    for (latency_hist_t<uint32_t>& hist : shard.latencies_by_ingress) {
+      hist.clear();
+    }
+    shard.latencies.clear();
+    for (packet_latencies_t<uint32_t>& packets : shard.packet_latencies_by_ingress) {
+      packets.clear();
+    }
+    shard.packet_latencies.clear();
+    std::fill(shard.flits_received_by_class.begin(), shard.flits_received_by_class.end(), 0);
+    for (latency_hist_t<uint32_t>& hist : shard.latencies_by_class) {
+      hist.clear();
+    }
+    for (packet_latencies_t<uint32_t>& packets : shard.packet_latencies_by_class) {
+      packets.clear();
+    }
+  }
+  this->reset_window_stats();
+}
+
+flit_t* traffic_eval_t::dequeue_flit(uint64_t ingress_id, bool ready, uint64_t current_cycle) {
+  // Pop a flit from the head of the ingress queue to send through the network
+  ingress_shard_t& shard = this->ingress_shards[ingress_id];
+  if (!ready || shard.queue.empty()) {
+    return NULL;
+  }
+  // Write the next flit of the front packet to the arena
+  queued_packet_t& packet = shard.queue.front();
+  bool head = shard.front_flits_sent == 0;
+  bool tail = shard.front_flits_sent + 1 == packet.num_flits;
+  flit_t* deq_flit = shard.flits.insert(flit_t(head, tail, ingress_id, packet.egress_id,
+					       this->get_new_unique_flit_id(ingress_id),
+					       packet.creation_cycle));
+  deq_flit->tag = packet.tag;
+  deq_flit->traffic_class = packet.traffic_class;
+  if (tail) {
+    shard.queue.pop();
+    shard.front_flits_sent = 0;
+  } else {
+    shard.front_flits_sent++;
+  }
+  // Packets leave the queue contiguously, so each flit carries the
+  // departure of its head
+  if (head) {
+    shard.head_departure_cycle = current_cycle;
+  }
+  deq_flit->head_departure_cycle = shard.head_departure_cycle;
+  shard.num_injected.store(shard.num_injected.load(std::memory_order_relaxed) + 1,
+			   std::memory_order_relaxed);
+  return deq_flit;
+}
+
+void traffic_eval_t::save(checkpoint_writer_t& ckpt) {
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    std::vector<flit_t> flits;
+    shard.flits.live_flits(flits);
+    for (flit_t& flit : flits) {
+      flit.tag = save_tag(flit.tag);
+    }
+    std::vector<queued_packet_t> queue;
+    for (ring_queue_t<queued_packet_t> q = shard.queue; !q.empty(); q.pop()) {
+      queue.push_back(q.front());
+      queue.back().tag = save_tag(queue.back().tag);
+    }
+    ckpt.put(shard.flits.next_seq());
+    ckpt.put_vector(flits);
+    ckpt.put_vector(queue);
+    ckpt.put(shard.front_flits_sent);
+    ckpt.put(shard.head_departure_cycle);
+    ckpt.put(shard.num_generated.load(std::memory_order_relaxed));
+    ckpt.put(shard.num_flushed.load(std::memory_order_relaxed));
+    ckpt.put(shard.num_injected.load(std::memory_order_relaxed));
+  }
+  for (egress_shard_t& shard : this->egress_shards) {
+    ckpt.put(shard.num_received.load(std::memory_order_relaxed));
+  }
+}
+
+void traffic_eval_t::restore(checkpoint_reader_t& ckpt) {
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    ingress_shard_t& shard = this->ingress_shards[i];
+    uint64_t next_seq = ckpt.get<uint64_t>();
+    std::vector<flit_t> flits = ckpt.get_vector<flit_t>();
+    std::vector<queued_packet_t> queue = ckpt.get_vector<queued_packet_t>();
+    if (ckpt.fail()) {
+      return;
+    }
+    for (flit_t& flit : flits) {
+      assert(flit.ingress_id == i && flit.unique_id >> flit_arena_t::SEQ_BITS == i);
+      flit.tag = restore_tag(flit.tag);
+    }
+    shard.flits.restore(next_seq, flits);
+    for (queued_packet_t& packet : queue) {
+      packet.tag = restore_tag(packet.tag);
+      shard.queue.push(packet);
+    }
+    shard.front_flits_sent = ckpt.get<uint64_t>();
+    shard.head_departure_cycle = ckpt.get<uint64_t>();
+    shard.num_generated = ckpt.get<uint64_t>();
+    shard.num_flushed = ckpt.get<uint64_t>();
+    shard.num_injected = ckpt.get<uint64_t>();
+  }
+  for (egress_shard_t& shard : this->egress_shards) {
+    shard.num_received = ckpt.get<uint64_t>();
   }
-  return tail_unique_id;
 }
 
 
@@ -344,42 +1833,170 @@ flit_t* random_traffic_eval_t::ingress_tick(uint64_t ingress_id,
 					    bool gen_packets,
 					    bool count_sent_flits
 					    ) {
-  // If in the packet generation phase, use a uniform random distribution
-  // to insert packets. Note this phase may generate many packets in a
-  // single cycle.
-
-  // Vector of egresses to generate a packet to
-  std::vector<uint64_t> to_emit;
   if (gen_packets) {
-    for (flow_rate_t &flow : this->flows_by_ingress[ingress_id]) {
-      float sample = this->egress_selector(this->generator);
-      if (sample * this->flits_per_packet < flow.rate) {
-	to_emit.push_back(flow.egress_id);
+    generate_packets(ingress_id, current_cycle, count_sent_flits);
+  }
+
+  return dequeue_flit(ingress_id, ready, current_cycle);
+}
+
+void random_traffic_eval_t::generate_packets(uint64_t ingress_id, uint64_t current_cycle,
+					     bool count_sent_flits) {
+  // In the packet generation phase, each flow generates packets
+  // according to its injection process. Rather than sampling every flow
+  // every cycle, each flow schedules the cycle of its next packet, and
+  // only flows whose packet is due are woken.
+  // Note this phase may generate many packets in a single cycle.
+  std::vector<injection_state_t>& flows = this->flows_by_ingress[ingress_id];
+  auto& arrivals = this->arrivals[ingress_id];
+  if (!this->arrivals_started[ingress_id]) {
+    for (uint64_t f = 0; f < flows.size(); f++) {
+      uint64_t arrival = first_arrival(flows[f], current_cycle);
+      if (arrival != std::numeric_limits<uint64_t>::max()) {
+	arrivals.push(arrival_t(arrival, f));
       }
     }
+    this->arrivals_started[ingress_id] = true;
   }
 
   // For each packet that we generate this cycle, construct the flits
   // and enqueue them in the ingress queue for this ingress point
-  std::queue<flit_t*> *ingress_q = &this->ingress_queues[ingress_id];
-  for (uint64_t &egress_id : to_emit) {
-    inject_flits_for_packet(ingress_id, egress_id, count_sent_flits, current_cycle);
+  while (!arrivals.empty() && arrivals.top().first <= current_cycle) {
+    if (hold_packets(ingress_id, count_sent_flits)) {
+      break;
+    }
+    arrival_t arrival = arrivals.top();
+    arrivals.pop();
+    injection_state_t& flow = flows[arrival.second];
+    flow.rng.seek(arrival.first);
+    uint64_t num_flits = sample_packet_size(flow);
+    enqueue_packet(ingress_id, flow.egress_id, num_flits, count_sent_flits, current_cycle,
+		   flow.traffic_class);
+    // A flow held back resumes its process from the cycle its packet was
+    // accepted
+    uint64_t from = this->flows_held ? current_cycle : arrival.first;
+    arrivals.push(arrival_t(next_arrival(flow, from, num_flits), arrival.second));
   }
+}
 
-  // Pop a flit from the head of the ingress queue to send through the network
-  flit_t* deq_flit = NULL;
-  if (ready && ingress_q->size() != 0) {
-    deq_flit = ingress_q->front();
-    ingress_q->pop();
+uint64_t traffic_eval_t::sample_gap(injection_state_t& state, double log_1mp) {
+  if (log_1mp == 0.0) {
+    return std::numeric_limits<uint64_t>::max();
   }
-  return deq_flit;
+  // Inverse CDF of the geometric distribution, with u in (0, 1]
+  double u = 1.0 - state.rng.uniform();
+  double gap = std::floor(std::log(u) / log_1mp);
+  if (gap >= (double)(std::numeric_limits<uint64_t>::max() / 2)) {
+    return std::numeric_limits<uint64_t>::max() / 2;
+  }
+  return (uint64_t)gap;
+}
+
+void traffic_eval_t::init_injection(injection_state_t& state, uint64_t ingress_id, uint64_t flow_id,
+				    uint64_t egress_id, float rate,
+				    const injection_process_t& process, const packet_size_t& size) {
+  state.egress_id = egress_id;
+  state.rng.init(this->seed, ingress_id, flow_id);
+  state.process = process;
+  state.size = size;
+  state.burst_remaining = 0;
+  state.traffic_class = 0;
+
+  // Mean cycles off between bursts, such that bursts of mean_burst packets
+  // at one flit per cycle average out to rate flits/cycle
+  double mean_size = size.mean();
+  double mean_on = process.mean_burst * mean_size;
+  double mean_off = rate > 0.0f ? mean_on * (1.0 - std::min(1.0f, rate)) / rate : 0.0;
+  switch (process.kind) {
+  case injection_process_t::BERNOULLI:
+    state.burst_param = log_1mp_of(std::min(1.0, (double)rate / mean_size));
+    state.off_param = 0.0;
+    break;
+  case injection_process_t::ONOFF:
+    state.burst_param = log_1mp_of(1.0 / process.mean_burst);
+    state.off_param = log_1mp_of(1.0 / (mean_off + 1.0));
+    break;
+  case injection_process_t::PARETO:
+    state.burst_param = process.mean_burst * (process.alpha - 1.0) / process.alpha;
+    state.off_param = mean_off * (process.alpha - 1.0) / process.alpha;
+    break;
+  }
+  if (rate <= 0.0f) {
+    // Never injects
+    state.process.kind = injection_process_t::BERNOULLI;
+    state.burst_param = 0.0;
+  }
+}
+
+uint64_t traffic_eval_t::sample_packet_size(injection_state_t& state) {
+  const packet_size_t& size = state.size;
+  switch (size.kind) {
+  case packet_size_t::UNIFORM:
+    return std::min(size.min + (uint64_t)(state.rng.uniform() * (size.max - size.min + 1)),
+		    size.max);
+  case packet_size_t::BIMODAL:
+    return state.rng.uniform() < size.prob_min ? size.min : size.max;
+  default:
+    return size.min;
+  }
+}
+
+uint64_t traffic_eval_t::sample_burst(injection_state_t& state) {
+  if (state.process.kind == injection_process_t::ONOFF) {
+    return 1 + sample_gap(state, state.burst_param);
+  }
+  return std::max((uint64_t)1, (uint64_t)std::llround(sample_pareto(state, state.burst_param, state.process.alpha)));
+}
+
+uint64_t traffic_eval_t::sample_off(injection_state_t& state) {
+  if (state.process.kind == injection_process_t::ONOFF) {
+    return sample_gap(state, state.off_param);
+  }
+  return (uint64_t)std::llround(sample_pareto(state, state.off_param, state.process.alpha));
+}
+
+uint64_t traffic_eval_t::first_arrival(injection_state_t& state, uint64_t current_cycle) {
+  state.rng.seek(current_cycle);
+  if (state.process.kind == injection_process_t::BERNOULLI) {
+    uint64_t gap = sample_gap(state, state.burst_param);
+    return gap == std::numeric_limits<uint64_t>::max() ? gap : current_cycle + gap;
+  }
+  // Bursty flows start in the off state
+  state.burst_remaining = sample_burst(state);
+  return current_cycle + sample_off(state);
+}
+
+uint64_t traffic_eval_t::next_arrival(injection_state_t& state, uint64_t arrival_cycle, uint64_t num_flits) {
+  state.rng.seek(arrival_cycle);
+  if (state.process.kind == injection_process_t::BERNOULLI) {
+    return arrival_cycle + 1 + sample_gap(state, state.burst_param);
+  }
+  // Within a burst, packets follow back-to-back at one flit per cycle
+  if (--state.burst_remaining > 0) {
+    return arrival_cycle + num_flits;
+  }
+  state.burst_remaining = sample_burst(state);
+  return arrival_cycle + num_flits + sample_off(state);
+}
+
+void traffic_eval_t::save_injection(checkpoint_writer_t& ckpt, const injection_state_t& state) {
+  ckpt.put(state.rng.cycle);
+  ckpt.put(state.rng.index);
+  ckpt.put(state.burst_remaining);
+}
+
+void traffic_eval_t::restore_injection(checkpoint_reader_t& ckpt, injection_state_t& state) {
+  state.rng.cycle = ckpt.get<uint64_t>();
+  state.rng.index = ckpt.get<uint64_t>();
+  state.burst_remaining = ckpt.get<uint64_t>();
 }
 
 void traffic_eval_t::eject_flits(bool head, bool tail,
 				 uint64_t ingress_id, uint64_t egress_id, uint64_t unique_id,
 				 uint64_t current_cycle,
 				 bool count_recvd_flits) {
-  flit_t* f = this->inflight_flits[unique_id];
+  // The flit is looked up in the arena of its ingress
+  flit_t* f = ingress_id < this->num_ingresses ? this->ingress_shards[ingress_id].flits.lookup(unique_id) : NULL;
   if (!f) {
     std::cout << "Lost flit " << unique_id << std::endl;
     exit(1);
@@ -387,15 +2004,35 @@ void traffic_eval_t::eject_flits(bool head, bool tail,
   assert(f->head == head);
   assert(f->tail == tail);
   assert(f->ingress_id == ingress_id);
-  assert(this->inflight_flits.erase(unique_id) == 1);
+  egress_shard_t& shard = this->egress_shards[egress_id];
   if (count_recvd_flits) {
     uint64_t latency = current_cycle - f->creation_cycle;
-    this->flits_received[ingress_id][egress_id]++;
-    this->total_flits_received++;
-    this->latencies_by_flow[ingress_id][egress_id][latency]++;
-    this->latencies[latency]++;
+    shard.flits_received[ingress_id]++;
+    shard.latencies_by_ingress[ingress_id].record(latency);
+    shard.latencies.record(latency);
+    shard.window_flits_received++;
+    shard.window_latencies.record(latency);
+    bool by_class = this->num_classes > 1;
+    if (by_class) {
+      shard.flits_received_by_class[f->traffic_class]++;
+      shard.latencies_by_class[f->traffic_class].record(latency);
+    }
+    if (tail && this->packet_stats) {
+      uint64_t queueing = f->head_departure_cycle - f->creation_cycle;
+      uint64_t network = current_cycle - f->head_departure_cycle;
+      shard.packet_latencies_by_ingress[ingress_id].record(queueing, network);
+      shard.packet_latencies.record(queueing, network);
+      if (by_class) {
+	shard.packet_latencies_by_class[f->traffic_class].record(queueing, network);
+      }
+    }
   }
-  delete f;
+  if (this->telemetry_enabled) {
+    shard.telemetry_latencies.record(current_cycle - f->creation_cycle);
+  }
+  this->ingress_shards[ingress_id].flits.erase(f);
+  shard.num_received.store(shard.num_received.load(std::memory_order_relaxed) + 1,
+			   std::memory_order_relaxed);
 }
 
 void random_traffic_eval_t::egress_tick(uint64_t egress_id,
@@ -412,109 +2049,996 @@ void random_traffic_eval_t::egress_tick(uint64_t egress_id,
 }
 
 random_traffic_eval_t::random_traffic_eval_t(runtime_params_t *params) : traffic_eval_t(params) {
-  this->generator = std::default_random_engine(0xdeadbeef);
-  this->egress_selector = std::uniform_real_distribution<float>(0.0, 1.0);
-  this->flows_by_ingress.resize(params->num_ingresses);
-  for (flow_rate_t& flow : params->flow_rates) {
-    this->flows_by_ingress[flow.ingress_id].push_back(flow);
-  }
+  this->params = params;
+  this->flows_held = params->source_queue_throttle;
+  set_load_scale(1.0f);
 }
 
-
-netrace_traffic_eval_t::netrace_traffic_eval_t(runtime_params_t *params) : traffic_eval_t(params) {
-  memset(&this->nt_ctx, 0, sizeof(nt_context_t));
-  this->waiting_queues.resize(params->num_ingresses);
-  this->ignore_dependencies = params->netrace_ignore_dependencies;
-
-  assert(params->netrace_enable);
-  std::cout << "Opening nettrace file " << params->netrace_trace << std::endl;
-  nt_open_trfile(&this->nt_ctx, params->netrace_trace.c_str());
-  if (params->netrace_ignore_dependencies) {
-    nt_disable_dependencies(&this->nt_ctx);
-  }
-  this->nt_header = nt_get_trheader(&this->nt_ctx);
-  int start_region = params->netrace_region;
-  assert(start_region >= 0 && start_region < 5);
-  nt_seek_region(&this->nt_ctx, &this->nt_header->regions[start_region]);
-  this->cycle_offset = 0;
-  for (uint64_t i = 0; i < start_region; i++) {
-    this->cycle_offset += this->nt_header->regions[i].num_cycles;
+uint64_t random_traffic_eval_t::next_event_cycle(uint64_t current_cycle) {
+  uint64_t next = std::numeric_limits<uint64_t>::max();
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    // Flows schedule their first packet on their first tick
+    if (!this->arrivals_started[i]) {
+      return current_cycle + 1;
+    }
+    if (!this->arrivals[i].empty()) {
+      next = std::min(next, this->arrivals[i].top().first);
+    }
   }
-
-  this->trace_packet = nt_read_packet(&this->nt_ctx);
-  this->next_cycle = 0;
+  return next;
 }
 
+void random_traffic_eval_t::set_load_scale(float scale) {
+  this->flows_by_ingress.clear();
+  this->flows_by_ingress.resize(this->num_ingresses);
+  this->arrivals.clear();
+  this->arrivals.resize(this->num_ingresses);
+  this->arrivals_started.assign(this->num_ingresses, false);
+  for (flow_rate_t& flow : this->params->flow_rates) {
+    injection_state_t state;
+    init_injection(state, flow.ingress_id, this->flows_by_ingress[flow.ingress_id].size(),
+		   flow.egress_id, flow.rate * scale, flow.process, flow.size);
+    state.traffic_class = flow.traffic_class;
+    this->flows_by_ingress[flow.ingress_id].push_back(state);
+  }
+}
 
-flit_t* netrace_traffic_eval_t::ingress_tick(uint64_t ingress_id, uint64_t current_cycle,
-					      char ready,
-					      bool gen_packets,
-					      bool count_sent_flits) {
-
-  if (ingress_id == 0) {
-    uint64_t all_ingress_q_size = 0;
-    for (uint64_t i = 0; i < params->num_ingresses; i++) {
-      all_ingress_q_size += this->ingress_queues[i].size();
+void random_traffic_eval_t::save(checkpoint_writer_t& ckpt) {
+  traffic_eval_t::save(ckpt);
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    std::vector<uint64_t> egresses;
+    for (injection_state_t& flow : this->flows_by_ingress[i]) {
+      egresses.push_back(flow.egress_id);
     }
-    std::cout << "Cycle: " << current_cycle << " inflight_flits: " << this->inflight_flits.size() << " " << all_ingress_q_size << std::endl;
-  }
-  if (gen_packets && current_cycle >= this->next_cycle) {
-    // If idle, fast-forward to next flit
-    if (this->trace_packet != NULL && this->trace_packet->cycle > this->cycle_offset && this->no_inflight_flits() && this->dead_packets.size() == 0) {
-      this->cycle_offset = this->trace_packet->cycle;
+    ckpt.put_vector(egresses);
+    for (injection_state_t& flow : this->flows_by_ingress[i]) {
+      save_injection(ckpt, flow);
     }
-
-    // Get packets from tracefile, put them in waiting queue
-    while (this->trace_packet != NULL && this->trace_packet->cycle <= current_cycle + this->cycle_offset) {
-      if (this->trace_packet->src >= this->num_ingresses || this->trace_packet->dst >= this->num_egresses) {
-	this->dead_packets.push_back(this->trace_packet);
-      } else {
-	std::pair<nt_packet_t*, uint64_t> pair;
-	pair.first = this->trace_packet;
-	pair.second = 0;
-	this->waiting_queues[this->trace_packet->src].push_back(pair);
-      }
-      this->trace_packet = nt_read_packet(&this->nt_ctx);
+    // Scheduled arrivals, as (cycle, flow) pairs
+    std::vector<uint64_t> arrivals;
+    for (auto heap = this->arrivals[i]; !heap.empty(); heap.pop()) {
+      arrivals.push_back(heap.top().first);
+      arrivals.push_back(heap.top().second);
     }
+    ckpt.put_vector(arrivals);
+    ckpt.put(this->arrivals_started[i]);
+  }
+}
 
-    // Dead packets finish instantly
-    std::list<nt_packet_t*>::iterator it = this->dead_packets.begin();
-    while (it != this->dead_packets.end()) {
-      if (nt_dependencies_cleared(&this->nt_ctx, *it)) {
-	nt_clear_dependencies_free_packet(&this->nt_ctx, *it);
-	it = this->dead_packets.erase(it);
-      } else {
-	it++;
-      }
+void random_traffic_eval_t::restore(checkpoint_reader_t& ckpt) {
+  traffic_eval_t::restore(ckpt);
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    std::vector<injection_state_t>& flows = this->flows_by_ingress[i];
+    std::vector<uint64_t> egresses = ckpt.get_vector<uint64_t>();
+    bool match = egresses.size() == flows.size();
+    for (uint64_t f = 0; match && f < flows.size(); f++) {
+      match = egresses[f] == flows[f].egress_id;
     }
+    if (!match) {
+      std::cout << "Checkpoint flows of ingress " << i << " do not match the config" << std::endl;
+      exit(1);
+    }
+    for (injection_state_t& flow : flows) {
+      restore_injection(ckpt, flow);
+    }
+    std::vector<uint64_t> arrivals = ckpt.get_vector<uint64_t>();
+    for (uint64_t a = 0; a + 1 < arrivals.size(); a += 2) {
+      assert(arrivals[a + 1] < flows.size());
+      this->arrivals[i].push(arrival_t(arrivals[a], arrivals[a + 1]));
+    }
+    this->arrivals_started[i] = ckpt.get<char>();
+  }
+}
 
 
-    // Move packets that have cleared dependencies from waiting queue into ingress queue
-    for (uint64_t i = 0; i < this->waiting_queues.size(); i++) {
-      std::list<std::pair<nt_packet_t*, uint64_t>>::iterator it = this->waiting_queues[i].begin();
-      while (it != this->waiting_queues[i].end()) {
-	nt_packet_t* packet = it->first;
-	if (nt_dependencies_cleared(&this->nt_ctx, packet) || this->ignore_dependencies) {
-	  uint64_t tail_unique_id = inject_flits_for_packet(i, packet->dst, count_sent_flits, current_cycle);
-	  this->nt_packet_map[tail_unique_id] = packet;
-	  it = this->waiting_queues[i].erase(it);
-	} else {
-	  it++;
-	}
-      }
+request_response_traffic_eval_t::request_response_traffic_eval_t(runtime_params_t *params)
+  : random_traffic_eval_t(params), endpoints(params->num_ingresses) {
+  if (params->netrace_enable || !params->pattern.empty()) {
+    std::cout << "Request/response traffic requires explicit flows" << std::endl;
+    exit(1);
+  }
+  if (params->source_queue_limit > 0) {
+    std::cout << "Request/response traffic is limited by its window, not source_queue" << std::endl;
+    exit(1);
+  }
+  if (this->num_ingresses != this->num_egresses) {
+    std::cout << "Request/response traffic requires num_ingresses == num_egresses" << std::endl;
+    exit(1);
+  }
+  this->window = params->request_window;
+  this->reply_flits = params->reply_flits;
+  this->service_latency = params->service_latency;
+  assert(this->window > 0 && this->reply_flits > 0);
+  this->flows_held = true;
+  for (endpoint_t& endpoint : this->endpoints) {
+    // Slots are taken from the back, so the lowest is issued first
+    for (uint64_t t = this->window; t > 0; t--) {
+      endpoint.free_slots.push_back(t - 1);
     }
-
+    endpoint.issue_cycles.assign(this->window, 0);
+    endpoint.reply_flits_sent = 0;
+    endpoint.transactions = 0;
+    endpoint.reply_flits_received = 0;
   }
+  this->measured_cycles = 0;
+  this->measuring = false;
+}
 
-  // Pop a flit from the head of the ingress queue to send through the network
-  flit_t* deq_flit = NULL;
-  std::queue<flit_t*> *ingress_q = &this->ingress_queues[ingress_id];
-  if (ready && ingress_q->size() != 0) {
-    deq_flit = ingress_q->front();
-    ingress_q->pop();
+void request_response_traffic_eval_t::enqueue_packet(uint64_t ingress_id, uint64_t egress_id,
+						     uint64_t num_flits, bool, uint64_t,
+						     uint64_t traffic_class) {
+  // Requests are issued into the ingress queue once a slot is free. As for
+  // a stalled requester, they are counted as sent and timed from their
+  // issue, by the ingress_tick which issues them.
+  this->endpoints[ingress_id].backlog.push({egress_id, num_flits, traffic_class});
+}
+
+bool request_response_traffic_eval_t::hold_packets(uint64_t ingress_id, bool) {
+  // A requester stalls once a window of requests awaits its slots, rather
+  // than generating open-loop past saturation
+  return this->endpoints[ingress_id].backlog.size() >= this->window;
+}
+
+flit_t* request_response_traffic_eval_t::ingress_tick(uint64_t ingress_id,
+						      uint64_t current_cycle, char ready,
+						      bool gen_packets,
+						      bool count_sent_flits
+						      ) {
+  if (gen_packets) {
+    generate_packets(ingress_id, current_cycle, count_sent_flits);
+  }
+
+  // Replies are still sent while draining, and pending replies count as
+  // inflight, so every issued transaction completes before the drain
+  // ends. Backlogged requests are not issued.
+  endpoint_t& endpoint = this->endpoints[ingress_id];
+  {
+    std::lock_guard<std::mutex> lock(endpoint.lock);
+    endpoint.free_slots.insert(endpoint.free_slots.end(),
+			       endpoint.completed_slots.begin(), endpoint.completed_slots.end());
+    endpoint.completed_slots.clear();
+    // Replies are queued ahead of new requests
+    while (!endpoint.replies.empty() && endpoint.replies.front().ready_cycle <= current_cycle) {
+      reply_t reply = endpoint.replies.front();
+      endpoint.replies.pop();
+      inject_flits_for_packet(ingress_id, reply.requester, this->reply_flits,
+			      false, current_cycle, REPLY_TAG | reply.transaction);
+      if (count_sent_flits) {
+	endpoint.reply_flits_sent += this->reply_flits;
+      }
+    }
+    while (gen_packets && !endpoint.backlog.empty() && !endpoint.free_slots.empty()) {
+      request_t request = endpoint.backlog.front();
+      endpoint.backlog.pop();
+      uint32_t transaction = endpoint.free_slots.back();
+      endpoint.free_slots.pop_back();
+      endpoint.issue_cycles[transaction] = current_cycle;
+      inject_flits_for_packet(ingress_id, request.egress_id, request.num_flits,
+			      count_sent_flits, current_cycle, transaction, request.traffic_class);
+    }
+  }
+
+  return dequeue_flit(ingress_id, ready, current_cycle);
+}
+
+void request_response_traffic_eval_t::egress_tick(uint64_t egress_id,
+						  bool* ready, bool valid, bool head, bool tail,
+						  uint64_t ingress_id, uint64_t unique_id,
+						  uint64_t current_cycle,
+						  bool count_recvd_flits
+						  ) {
+  *ready = true;
+
+  // Cycles skipped by fast-forward within the measurement phase are
+  // measured too
+  if (egress_id == 0) {
+    if (count_recvd_flits) {
+      this->measured_cycles += this->measuring ? current_cycle - this->last_measured_cycle : 1;
+      this->last_measured_cycle = current_cycle;
+    }
+    this->measuring = count_recvd_flits;
+  }
+
+  if (valid) {
+    // The flit is read before eject_flits retires it, which reports lost
+    // flits
+    flit_t* f = ingress_id < this->num_ingresses ?
+      this->ingress_shards[ingress_id].flits.lookup(unique_id) : NULL;
+    bool reply = f && (f->tag & REPLY_TAG);
+    uint32_t transaction = f ? (uint32_t)f->tag : 0;
+    endpoint_t& endpoint = this->endpoints[egress_id];
+    if (reply && count_recvd_flits) {
+      endpoint.reply_flits_received++;
+      endpoint.reply_latencies.record(current_cycle - f->creation_cycle);
+    }
+    if (reply && tail) {
+      // Complete the transaction of this endpoint's request
+      uint64_t issue_cycle;
+      {
+	std::lock_guard<std::mutex> lock(endpoint.lock);
+	endpoint.completed_slots.push_back(transaction);
+	issue_cycle = endpoint.issue_cycles[transaction];
+      }
+      if (count_recvd_flits) {
+	endpoint.transactions++;
+	endpoint.round_trips.record(current_cycle - issue_cycle);
+      }
+    } else if (f && tail) {
+      // Schedule the reply from this endpoint to the requester, which is
+      // inflight until it is sent
+      std::lock_guard<std::mutex> lock(endpoint.lock);
+      endpoint.replies.push({current_cycle + this->service_latency, ingress_id, transaction});
+    }
+    eject_flits(head, tail, ingress_id, egress_id, unique_id, current_cycle, count_recvd_flits && !reply);
+  }
+}
+
+uint64_t request_response_traffic_eval_t::next_event_cycle(uint64_t current_cycle) {
+  uint64_t next = random_traffic_eval_t::next_event_cycle(current_cycle);
+  for (endpoint_t& endpoint : this->endpoints) {
+    std::lock_guard<std::mutex> lock(endpoint.lock);
+    if (!endpoint.backlog.empty() || !endpoint.completed_slots.empty()) {
+      return current_cycle + 1;
+    }
+    if (!endpoint.replies.empty()) {
+      next = std::min(next, endpoint.replies.front().ready_cycle);
+    }
+  }
+  return next;
+}
+
+void request_response_traffic_eval_t::count_inflight_flits() {
+  // Pending replies count as inflight, so the drain waits for them
+  traffic_eval_t::count_inflight_flits();
+  uint64_t pending = 0;
+  for (endpoint_t& endpoint : this->endpoints) {
+    std::lock_guard<std::mutex> lock(endpoint.lock);
+    pending += endpoint.replies.size() * this->reply_flits;
+  }
+  this->inflight_flits.store(this->inflight_flits.load(std::memory_order_relaxed) + pending,
+			     std::memory_order_relaxed);
+}
+
+void request_response_traffic_eval_t::flush_ingress_queues() {
+  // Issued requests hold transaction slots, and are not flushed
+  for (endpoint_t& endpoint : this->endpoints) {
+    endpoint.backlog = ring_queue_t<request_t>();
+  }
+}
+
+void request_response_traffic_eval_t::reset_stats() {
+  traffic_eval_t::reset_stats();
+  for (endpoint_t& endpoint : this->endpoints) {
+    endpoint.reply_flits_sent = 0;
+    endpoint.transactions = 0;
+    endpoint.round_trips.clear();
+    endpoint.reply_flits_received = 0;
+    endpoint.reply_latencies.clear();
+  }
+  this->measured_cycles = 0;
+}
+
+void request_response_traffic_eval_t::save(checkpoint_writer_t& ckpt) {
+  random_traffic_eval_t::save(ckpt);
+  for (endpoint_t& endpoint : this->endpoints) {
+    ckpt.put_queue(endpoint.backlog);
+    ckpt.put_vector(endpoint.free_slots);
+    ckpt.put_queue(endpoint.replies);
+    ckpt.put_vector(endpoint.completed_slots);
+    ckpt.put_vector(endpoint.issue_cycles);
+  }
+}
+
+void request_response_traffic_eval_t::restore(checkpoint_reader_t& ckpt) {
+  random_traffic_eval_t::restore(ckpt);
+  for (endpoint_t& endpoint : this->endpoints) {
+    ckpt.get_queue(endpoint.backlog);
+    endpoint.free_slots = ckpt.get_vector<uint32_t>();
+    ckpt.get_queue(endpoint.replies);
+    endpoint.completed_slots = ckpt.get_vector<uint32_t>();
+    endpoint.issue_cycles = ckpt.get_vector<uint64_t>();
+    // Transaction slots index issue_cycles, so the windows must match
+    if (endpoint.issue_cycles.size() != this->window) {
+      std::cout << "Checkpoint request window does not match the config" << std::endl;
+      exit(1);
+    }
+  }
+}
+
+void request_response_traffic_eval_t::print_results(std::ostream& os) {
+  latency_hist_t<uint64_t> round_trips;
+  latency_hist_t<uint64_t> reply_latencies;
+  uint64_t transactions = 0;
+  uint64_t reply_flits_sent = 0;
+  uint64_t reply_flits_received = 0;
+  double cycles = std::max(this->measured_cycles, (uint64_t)1);
+  os << "Request/response CSV:" << std::endl;
+  os << "ingress_id, transactions, transactions_per_cycle, median_round_trip, p99_round_trip, max_round_trip" << std::endl;
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    endpoint_t& endpoint = this->endpoints[i];
+    if (this->flows_by_ingress[i].empty()) {
+      continue;
+    }
+    os << i << ", "
+       << endpoint.transactions << ", "
+       << endpoint.transactions / cycles << ", "
+       << endpoint.round_trips.median() << ", "
+       << endpoint.round_trips.quantile(0.99) << ", "
+       << endpoint.round_trips.max()
+       << std::endl;
+    transactions += endpoint.transactions;
+    round_trips.merge(endpoint.round_trips);
+  }
+  for (endpoint_t& endpoint : this->endpoints) {
+    reply_flits_sent += endpoint.reply_flits_sent;
+    reply_flits_received += endpoint.reply_flits_received;
+    reply_latencies.merge(endpoint.reply_latencies);
+  }
+  os << "Transactions: " << transactions << std::endl
+     << "Transactions per cycle: " << transactions / cycles << std::endl
+     << "Median round trip: " << round_trips.median() << std::endl
+     << "P99 round trip: " << round_trips.quantile(0.99) << std::endl
+     << "Max round trip: " << round_trips.max() << std::endl
+     << "Reply flits: " << reply_flits_received << " received of " << reply_flits_sent << " sent" << std::endl
+     << "Median reply latency: " << reply_latencies.median() << std::endl
+     << "P99 reply latency: " << reply_latencies.quantile(0.99) << std::endl;
+}
+
+void request_response_traffic_eval_t::print_json(std::ostream& os) {
+  latency_hist_t<uint64_t> round_trips;
+  latency_hist_t<uint64_t> reply_latencies;
+  uint64_t transactions = 0;
+  uint64_t reply_flits_sent = 0;
+  uint64_t reply_flits_received = 0;
+  double cycles = std::max(this->measured_cycles, (uint64_t)1);
+  os << "{\"window\": " << this->window
+     << ", \"reply_flits\": " << this->reply_flits
+     << ", \"service_latency\": " << this->service_latency
+     << ", \"requesters\": [";
+  bool first = true;
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    endpoint_t& endpoint = this->endpoints[i];
+    if (this->flows_by_ingress[i].empty()) {
+      continue;
+    }
+    os << (first ? "" : ", ")
+       << "{\"ingress_id\": " << i
+       << ", \"transactions\": " << endpoint.transactions
+       << ", \"transactions_per_cycle\": " << endpoint.transactions / cycles
+       << ", \"median_round_trip\": " << endpoint.round_trips.median()
+       << ", \"p99_round_trip\": " << endpoint.round_trips.quantile(0.99)
+       << ", \"max_round_trip\": " << endpoint.round_trips.max() << "}";
+    first = false;
+    transactions += endpoint.transactions;
+    round_trips.merge(endpoint.round_trips);
+  }
+  for (endpoint_t& endpoint : this->endpoints) {
+    reply_flits_sent += endpoint.reply_flits_sent;
+    reply_flits_received += endpoint.reply_flits_received;
+    reply_latencies.merge(endpoint.reply_latencies);
+  }
+  os << "], \"measured_cycles\": " << this->measured_cycles
+     << ", \"transactions\": " << transactions
+     << ", \"transactions_per_cycle\": " << transactions / cycles
+     << ", \"round_trip\": {\"mean\": " << json_number(round_trips.mean())
+     << ", \"median\": " << round_trips.median()
+     << ", \"p99\": " << round_trips.quantile(0.99)
+     << ", \"max\": " << round_trips.max() << "}"
+     << ", \"replies\": {\"flits_sent\": " << reply_flits_sent
+     << ", \"flits_received\": " << reply_flits_received
+     << ", \"latency\": {\"mean\": " << json_number(reply_latencies.mean())
+     << ", \"median\": " << reply_latencies.median()
+     << ", \"p99\": " << reply_latencies.quantile(0.99)
+     << ", \"max\": " << reply_latencies.max() << "}}}";
+}
+
+
+pattern_traffic_eval_t::pattern_traffic_eval_t(runtime_params_t *params) : traffic_eval_t(params) {
+  const std::string& name = params->pattern;
+  if (name == "uniform") {
+    this->pattern = UNIFORM;
+  } else if (name == "transpose") {
+    this->pattern = TRANSPOSE;
+  } else if (name == "bitcomp") {
+    this->pattern = BITCOMP;
+  } else if (name == "bitrev") {
+    this->pattern = BITREV;
+  } else if (name == "shuffle") {
+    this->pattern = SHUFFLE;
+  } else if (name == "tornado") {
+    this->pattern = TORNADO;
+  } else if (name == "neighbor") {
+    this->pattern = NEIGHBOR;
+  } else if (name == "hotspot") {
+    this->pattern = HOTSPOT;
+  } else {
+    std::cout << "Unknown traffic pattern " << name << std::endl;
+    exit(1);
+  }
+
+  uint64_t n = this->num_egresses;
+  bool permutation = this->pattern != UNIFORM && this->pattern != HOTSPOT;
+  if (permutation && this->num_ingresses != n) {
+    std::cout << "Pattern " << name << " requires num_ingresses == num_egresses" << std::endl;
+    exit(1);
+  }
+
+  this->bits = 0;
+  while (((uint64_t)1 << this->bits) < n) { this->bits++; }
+  if ((this->pattern == BITCOMP || this->pattern == BITREV || this->pattern == SHUFFLE) &&
+      ((uint64_t)1 << this->bits) != n) {
+    std::cout << "Pattern " << name << " requires a power-of-two number of terminals" << std::endl;
+    exit(1);
+  }
+
+  // Default to a square 2D arrangement if possible, otherwise a 1D ring
+  this->radix = params->pattern_radix;
+  if (this->radix == 0) {
+    uint64_t k = (uint64_t)std::llround(std::sqrt((double)n));
+    this->radix = k * k == n ? k : n;
+  }
+  this->dims = 0;
+  for (uint64_t size = 1; size < n; size *= this->radix) { this->dims++; }
+  uint64_t size = 1;
+  for (uint64_t d = 0; d < this->dims; d++) { size *= this->radix; }
+  if ((this->pattern == TRANSPOSE || this->pattern == TORNADO || this->pattern == NEIGHBOR) &&
+      (size != n || (this->pattern == TRANSPOSE && this->dims != 2))) {
+    std::cout << "Pattern " << name << " does not fit " << n << " terminals with radix "
+	      << this->radix << std::endl;
+    exit(1);
+  }
+
+  this->hotspot_fraction = params->hotspot_fraction;
+  this->hotspot_egresses = params->hotspot_egresses;
+  for (uint64_t e : this->hotspot_egresses) {
+    assert(e < n);
+  }
+
+  this->params = params;
+  set_load_scale(1.0f);
+}
+
+void pattern_traffic_eval_t::set_load_scale(float scale) {
+  this->injections.resize(this->num_ingresses);
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    init_injection(this->injections[i], i, 0, 0, this->params->pattern_rate * scale,
+		   this->params->injection_process, this->params->packet_size);
+  }
+  this->next_arrivals.assign(this->num_ingresses, 0);
+  this->arrivals_started.assign(this->num_ingresses, false);
+}
+
+void pattern_traffic_eval_t::save(checkpoint_writer_t& ckpt) {
+  traffic_eval_t::save(ckpt);
+  for (injection_state_t& state : this->injections) {
+    save_injection(ckpt, state);
+  }
+  ckpt.put_vector(this->next_arrivals);
+  ckpt.put_vector(this->arrivals_started);
+}
+
+void pattern_traffic_eval_t::restore(checkpoint_reader_t& ckpt) {
+  traffic_eval_t::restore(ckpt);
+  for (injection_state_t& state : this->injections) {
+    restore_injection(ckpt, state);
+  }
+  std::vector<uint64_t> next_arrivals = ckpt.get_vector<uint64_t>();
+  std::vector<char> arrivals_started = ckpt.get_vector<char>();
+  if (next_arrivals.size() == this->num_ingresses && arrivals_started.size() == this->num_ingresses) {
+    this->next_arrivals = next_arrivals;
+    this->arrivals_started = arrivals_started;
+  }
+}
+
+uint64_t pattern_traffic_eval_t::get_egress(uint64_t ingress_id) {
+  uint64_t n = this->num_egresses;
+  uint64_t mask = ((uint64_t)1 << this->bits) - 1;
+  switch (this->pattern) {
+  case UNIFORM:
+    return get_uniform_egress(ingress_id);
+  case TRANSPOSE:
+    return (ingress_id % this->radix) * this->radix + ingress_id / this->radix;
+  case BITCOMP:
+    return ~ingress_id & mask;
+  case BITREV: {
+    uint64_t egress_id = 0;
+    for (uint64_t b = 0; b < this->bits; b++) {
+      egress_id |= ((ingress_id >> b) & 1) << (this->bits - 1 - b);
+    }
+    return egress_id;
+  }
+  case SHUFFLE:
+    return this->bits == 0 ? 0 : ((ingress_id << 1) | (ingress_id >> (this->bits - 1))) & mask;
+  case TORNADO:
+  case NEIGHBOR: {
+    // Offset each coordinate by just under half the radix, or by one
+    uint64_t offset = this->pattern == TORNADO ? (this->radix + 1) / 2 - 1 : 1;
+    uint64_t egress_id = 0;
+    uint64_t scale = 1;
+    for (uint64_t d = 0; d < this->dims; d++) {
+      uint64_t coord = (ingress_id / scale) % this->radix;
+      egress_id += ((coord + offset) % this->radix) * scale;
+      scale *= this->radix;
+    }
+    return egress_id;
   }
+  case HOTSPOT:
+    rng_stream_t& rng = this->injections[ingress_id].rng;
+    if (rng.uniform() < this->hotspot_fraction) {
+      uint64_t h = std::min((uint64_t)(rng.uniform() * this->hotspot_egresses.size()),
+			    (uint64_t)this->hotspot_egresses.size() - 1);
+      return this->hotspot_egresses[h];
+    }
+    return get_uniform_egress(ingress_id);
+  }
+  assert(false);
+  return n;
+}
+
+flit_t* pattern_traffic_eval_t::ingress_tick(uint64_t ingress_id,
+					     uint64_t current_cycle, char ready,
+					     bool gen_packets,
+					     bool count_sent_flits
+					     ) {
+  // Each ingress injects packets at pattern_rate according to the
+  // injection process, scheduling the cycle of its next packet. The egress
+  // of each packet is drawn when it is generated.
+  if (gen_packets) {
+    injection_state_t& state = this->injections[ingress_id];
+    uint64_t& next = this->next_arrivals[ingress_id];
+    if (!this->arrivals_started[ingress_id]) {
+      next = first_arrival(state, current_cycle);
+      this->arrivals_started[ingress_id] = true;
+    }
+    while (next <= current_cycle && !throttle_source(ingress_id, count_sent_flits)) {
+      state.rng.seek(next);
+      uint64_t num_flits = sample_packet_size(state);
+      inject_flits_for_packet(ingress_id, get_egress(ingress_id), num_flits,
+			      count_sent_flits, current_cycle);
+      // A throttled ingress resumes its process from the cycle its packet
+      // was accepted
+      next = next_arrival(state, this->source_queue_throttle ? current_cycle : next, num_flits);
+    }
+  }
+
+  return dequeue_flit(ingress_id, ready, current_cycle);
+}
+
+uint64_t pattern_traffic_eval_t::next_event_cycle(uint64_t current_cycle) {
+  uint64_t next = std::numeric_limits<uint64_t>::max();
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    if (!this->arrivals_started[i]) {
+      return current_cycle + 1;
+    }
+    next = std::min(next, this->next_arrivals[i]);
+  }
+  return next;
+}
+
+void pattern_traffic_eval_t::egress_tick(uint64_t egress_id,
+					 bool* ready, bool valid, bool head, bool tail,
+					 uint64_t ingress_id, uint64_t unique_id,
+					 uint64_t current_cycle,
+					 bool count_recvd_flits
+					 ) {
+  *ready = true;
+
+  if (valid) {
+    eject_flits(head, tail, ingress_id, egress_id, unique_id, current_cycle, count_recvd_flits);
+  }
+}
+
+
+netrace_traffic_eval_t::netrace_traffic_eval_t(runtime_params_t *params) : traffic_eval_t(params) {
+  memset(&this->nt_ctx, 0, sizeof(nt_context_t));
+  this->ready_queues.resize(params->num_ingresses);
+  this->ignore_dependencies = params->netrace_ignore_dependencies;
+  // Dropping or delaying trace packets would change the trace
+  if (params->source_queue_limit > 0) {
+    std::cout << "Netrace traffic does not support source_queue" << std::endl;
+    exit(1);
+  }
+
+  assert(params->netrace_enable);
+  // A negative region wraps, and fails the bound check
+  uint64_t start_region = params->netrace_region;
+  this->cycle_offset = 0;
+  this->binary_trace = NULL;
+  this->nt_header = NULL;
+  if (trace_binary_t::is_binary_trace(params->netrace_trace)) {
+    // Binary traces index their regions, so seeking is a lookup
+    std::cout << "Mapping binary trace file " << params->netrace_trace << std::endl;
+    this->binary_trace = new trace_binary_t();
+    if (!this->binary_trace->open(params->netrace_trace)) {
+      std::cout << "Malformed binary trace " << params->netrace_trace << std::endl;
+      exit(1);
+    }
+    const trace_binary_region_t* regions = this->binary_trace->regions();
+    assert(start_region < this->binary_trace->header()->num_regions);
+    this->binary_first_packet = regions[start_region].first_packet;
+    this->binary_next_packet = this->binary_first_packet;
+    for (uint64_t i = 0; i < start_region; i++) {
+      this->cycle_offset += regions[i].num_cycles;
+    }
+  } else {
+    std::cout << "Opening nettrace file " << params->netrace_trace << std::endl;
+    nt_open_trfile(&this->nt_ctx, params->netrace_trace.c_str());
+    // Dependencies are tracked by read_trace_packet, as netrace's own
+    // tracking is not thread-safe
+    nt_disable_dependencies(&this->nt_ctx);
+    this->nt_header = nt_get_trheader(&this->nt_ctx);
+    assert(start_region < 5);
+    nt_seek_region(&this->nt_ctx, &this->nt_header->regions[start_region]);
+    for (uint64_t i = 0; i < start_region; i++) {
+      this->cycle_offset += this->nt_header->regions[i].num_cycles;
+    }
+  }
+
+  // Past this point, only the prefetch thread may decode the trace.
+  // Mapped binary traces are cheap to decode, and are not prefetched.
+  this->prefetch_ring = NULL;
+  this->prefetch_stop = false;
+  this->prefetch_done = false;
+  if (params->netrace_prefetch > 0 && !this->binary_trace) {
+    uint64_t capacity = 1;
+    while (capacity < params->netrace_prefetch) { capacity <<= 1; }
+    this->prefetch_ring = new spsc_ring_t<nt_packet_t*>(capacity);
+    this->prefetch_thread = std::thread(&netrace_traffic_eval_t::prefetch_trace, this);
+  }
+
+  this->trace_packets_read = 0;
+  this->trace_packet = read_trace_packet();
+  this->next_cycle = 0;
+}
+
+nt_packet_t* netrace_traffic_eval_t::decode_trace_packet() {
+  if (!this->binary_trace) {
+    return nt_read_packet(&this->nt_ctx);
+  }
+  if (this->binary_next_packet >= this->binary_trace->header()->num_packets) {
+    return NULL;
+  }
+  // Dependencies point into the mapping, rather than being copied
+  const trace_binary_packet_t* record = &this->binary_trace->packets()[this->binary_next_packet++];
+  nt_packet_t* packet = new nt_packet_t;
+  packet->cycle = record->cycle;
+  packet->id = record->id;
+  packet->addr = record->addr;
+  packet->type = record->type;
+  packet->src = record->src;
+  packet->dst = record->dst;
+  packet->node_types = record->node_types;
+  packet->num_deps = record->num_deps;
+  packet->deps = (nt_dependency_t*)this->binary_trace->deps(record);
+  return packet;
+}
+
+void netrace_traffic_eval_t::prefetch_trace() {
+  nt_packet_t* packet = NULL;
+  while (!this->prefetch_stop.load(std::memory_order_relaxed)) {
+    packet = decode_trace_packet();
+    // Sleep while the lookahead window is full
+    bool pushed;
+    while (!(pushed = this->prefetch_ring->try_push(packet)) &&
+	   !this->prefetch_stop.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    if (!pushed) {
+      if (packet) {
+	free_trace_packet(packet);
+      }
+      break;
+    }
+    // The consumer checks the ring under the lock before waiting, so
+    // taking it here orders the push before the signal
+    { std::lock_guard<std::mutex> lock(this->prefetch_lock); }
+    this->prefetch_pushed.notify_one();
+    if (!packet) {
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> lock(this->prefetch_lock);
+  this->prefetch_done = true;
+  this->prefetch_pushed.notify_one();
+}
+
+void netrace_traffic_eval_t::finish() {
+  if (!this->prefetch_thread.joinable()) {
+    return;
+  }
+  this->prefetch_stop = true;
+  this->prefetch_thread.join();
+  nt_packet_t* packet;
+  while (this->prefetch_ring->try_pop(packet)) {
+    if (packet) {
+      free_trace_packet(packet);
+    }
+  }
+}
+
+nt_packet_t* netrace_traffic_eval_t::read_trace_packet() {
+  nt_packet_t* packet = NULL;
+  if (this->prefetch_ring) {
+    // Block rather than spin, as the caller holds trace_lock. Once the
+    // thread is done, an empty ring is the end of the trace.
+    if (!this->prefetch_ring->try_pop(packet)) {
+      std::unique_lock<std::mutex> lock(this->prefetch_lock);
+      this->prefetch_pushed.wait(lock, [&] {
+	return this->prefetch_ring->try_pop(packet) || this->prefetch_done;
+      });
+    }
+  } else {
+    packet = decode_trace_packet();
+  }
+  if (packet) {
+    this->trace_packets_read++;
+  }
+  if (packet && !this->ignore_dependencies) {
+    for (uint64_t i = 0; i < packet->num_deps; i++) {
+      this->dependency_refs[packet->deps[i]]++;
+    }
+  }
+  return packet;
+}
+
+bool netrace_traffic_eval_t::dependencies_cleared(nt_packet_t* packet) {
+  return this->ignore_dependencies || this->dependency_refs.count(packet->id) == 0;
+}
+
+void netrace_traffic_eval_t::release_packet(nt_packet_t* packet) {
+  if (outside_network(packet)) {
+    // Dead packets finish instantly
+    clear_dependencies_free_packet(packet);
+  } else {
+    this->ready_queues[packet->src].push(packet);
+  }
+}
+
+void netrace_traffic_eval_t::clear_dependencies_free_packet(nt_packet_t* packet) {
+  // Dead children finish in turn, depth first, from a worklist rather than
+  // by recursion, as a trace may chain many of them
+  std::vector<std::pair<nt_packet_t*, uint64_t>>& finishing = this->finishing_packets;
+  finishing.push_back({packet, 0});
+  while (!finishing.empty()) {
+    nt_packet_t* parent = finishing.back().first;
+    uint64_t i = finishing.back().second++;
+    if (this->ignore_dependencies || i == parent->num_deps) {
+      finishing.pop_back();
+      free_trace_packet(parent);
+      continue;
+    }
+    auto it = this->dependency_refs.find(parent->deps[i]);
+    assert(it != this->dependency_refs.end());
+    if (--it->second > 0) {
+      continue;
+    }
+    this->dependency_refs.erase(it);
+    // Release the child if it has been read and was waiting on us
+    auto blocked = this->blocked_packets.find(parent->deps[i]);
+    if (blocked != this->blocked_packets.end()) {
+      nt_packet_t* child = blocked->second;
+      this->blocked_packets.erase(blocked);
+      if (outside_network(child)) {
+	finishing.push_back({child, 0});
+      } else {
+	this->ready_queues[child->src].push(child);
+      }
+    }
+  }
+}
+
+void netrace_traffic_eval_t::free_trace_packet(nt_packet_t* packet) {
+  if (this->binary_trace) {
+    delete packet;
+  } else {
+    nt_packet_free(packet);
+  }
+}
+
+uint64_t netrace_traffic_eval_t::save_tag(uint64_t tag) {
+  return this->checkpoint_indices.at((nt_packet_t*)(uintptr_t)tag);
+}
+
+uint64_t netrace_traffic_eval_t::restore_tag(uint64_t tag) {
+  assert(tag < this->checkpoint_packets.size());
+  return (uint64_t)(uintptr_t)this->checkpoint_packets[tag];
+}
+
+// Packets are saved as binary trace records. The dependencies of packets
+// mapped from a binary trace are found by their offset into the mapping,
+// and otherwise follow the record.
+void netrace_traffic_eval_t::save_trace_packet(checkpoint_writer_t& ckpt, nt_packet_t* packet) {
+  trace_binary_packet_t record;
+  memset(&record, 0, sizeof(record));
+  record.cycle = packet->cycle;
+  record.id = packet->id;
+  record.addr = packet->addr;
+  record.type = packet->type;
+  record.src = packet->src;
+  record.dst = packet->dst;
+  record.node_types = packet->node_types;
+  record.num_deps = packet->num_deps;
+  if (this->binary_trace) {
+    record.deps_offset = (const uint32_t*)packet->deps - this->binary_trace->all_deps();
+  }
+  ckpt.put(record);
+  if (!this->binary_trace) {
+    ckpt.put_vector(std::vector<nt_dependency_t>(packet->deps, packet->deps + packet->num_deps));
+  }
+}
+
+nt_packet_t* netrace_traffic_eval_t::restore_trace_packet(checkpoint_reader_t& ckpt) {
+  trace_binary_packet_t record = ckpt.get<trace_binary_packet_t>();
+  nt_packet_t* packet;
+  if (this->binary_trace) {
+    packet = new nt_packet_t;
+    assert(record.deps_offset + record.num_deps <= this->binary_trace->header()->num_deps);
+    packet->deps = (nt_dependency_t*)(this->binary_trace->all_deps() + record.deps_offset);
+  } else {
+    std::vector<nt_dependency_t> deps = ckpt.get_vector<nt_dependency_t>();
+    record.num_deps = deps.size();
+    // Allocated as by netrace, which frees them
+    packet = nt_packet_malloc();
+    packet->deps = NULL;
+    if (!deps.empty()) {
+      packet->deps = (nt_dependency_t*)malloc(deps.size() * sizeof(nt_dependency_t));
+      memcpy(packet->deps, deps.data(), deps.size() * sizeof(nt_dependency_t));
+    }
+  }
+  packet->cycle = record.cycle;
+  packet->id = record.id;
+  packet->addr = record.addr;
+  packet->type = record.type;
+  packet->src = record.src;
+  packet->dst = record.dst;
+  packet->node_types = record.node_types;
+  packet->num_deps = record.num_deps;
+  return packet;
+}
+
+void netrace_traffic_eval_t::save(checkpoint_writer_t& ckpt) {
+  std::lock_guard<std::mutex> lock(this->trace_lock);
+  // Gather the live trace packets: those queued or inflight, ready, and
+  // blocked on their parents
+  std::vector<nt_packet_t*> packets;
+  auto add = [this, &packets](nt_packet_t* packet) {
+    if (this->checkpoint_indices.emplace(packet, packets.size()).second) {
+      packets.push_back(packet);
+    }
+  };
+  for (ingress_shard_t& shard : this->ingress_shards) {
+    std::vector<flit_t> flits;
+    shard.flits.live_flits(flits);
+    for (flit_t& flit : flits) {
+      add((nt_packet_t*)(uintptr_t)flit.tag);
+    }
+    for (ring_queue_t<queued_packet_t> q = shard.queue; !q.empty(); q.pop()) {
+      add((nt_packet_t*)(uintptr_t)q.front().tag);
+    }
+  }
+  std::vector<std::vector<uint64_t>> ready(this->num_ingresses);
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    for (ring_queue_t<nt_packet_t*> q = this->ready_queues[i]; !q.empty(); q.pop()) {
+      add(q.front());
+      ready[i].push_back(this->checkpoint_indices[q.front()]);
+    }
+  }
+  std::vector<uint64_t> blocked;
+  for (auto& it : this->blocked_packets) {
+    add(it.second);
+    blocked.push_back(this->checkpoint_indices[it.second]);
+  }
+
+  ckpt.put(this->ignore_dependencies);
+  ckpt.put<uint64_t>(packets.size());
+  for (nt_packet_t* packet : packets) {
+    save_trace_packet(ckpt, packet);
+  }
+  traffic_eval_t::save(ckpt);
+  for (std::vector<uint64_t>& r : ready) {
+    ckpt.put_vector(r);
+  }
+  ckpt.put_vector(blocked);
+  // Unfinished parents, as (id, children) pairs
+  std::vector<uint32_t> refs;
+  for (auto& it : this->dependency_refs) {
+    refs.push_back(it.first);
+    refs.push_back(it.second);
+  }
+  ckpt.put_vector(refs);
+  // The trace is resumed from the packets read before trace_packet
+  ckpt.put(this->trace_packets_read - (this->trace_packet ? 1 : 0));
+  ckpt.put(this->cycle_offset);
+  ckpt.put(this->next_cycle);
+  this->checkpoint_indices.clear();
+}
+
+void netrace_traffic_eval_t::restore(checkpoint_reader_t& ckpt) {
+  std::lock_guard<std::mutex> lock(this->trace_lock);
+  if (ckpt.get<bool>() != this->ignore_dependencies) {
+    std::cout << "Checkpoint netrace_ignore_dependencies does not match the config" << std::endl;
+    exit(1);
+  }
+  uint64_t num_packets = ckpt.get<uint64_t>();
+  for (uint64_t i = 0; i < num_packets && !ckpt.fail(); i++) {
+    this->checkpoint_packets.push_back(restore_trace_packet(ckpt));
+  }
+  traffic_eval_t::restore(ckpt);
+  for (uint64_t i = 0; i < this->num_ingresses; i++) {
+    for (uint64_t index : ckpt.get_vector<uint64_t>()) {
+      this->ready_queues[i].push((nt_packet_t*)(uintptr_t)restore_tag(index));
+    }
+  }
+  for (uint64_t index : ckpt.get_vector<uint64_t>()) {
+    nt_packet_t* packet = (nt_packet_t*)(uintptr_t)restore_tag(index);
+    this->blocked_packets[packet->id] = packet;
+  }
+  std::vector<uint32_t> refs = ckpt.get_vector<uint32_t>();
+
+  // Seek back to the saved position and resume from the packet at it.
+  // Binary traces index their packets, while netrace files are read from
+  // the start of the region.
+  uint64_t position = ckpt.get<uint64_t>();
+  if (this->binary_trace) {
+    if (this->trace_packet) {
+      free_trace_packet(this->trace_packet);
+    }
+    this->binary_next_packet = this->binary_first_packet + position;
+    this->trace_packets_read = position;
+    this->trace_packet = read_trace_packet();
+  }
+  while (this->trace_packet && this->trace_packets_read <= position) {
+    free_trace_packet(this->trace_packet);
+    this->trace_packet = read_trace_packet();
+  }
+  this->dependency_refs.clear();
+  for (uint64_t r = 0; r + 1 < refs.size(); r += 2) {
+    this->dependency_refs[refs[r]] = refs[r + 1];
+  }
+  this->cycle_offset = ckpt.get<uint64_t>();
+  this->next_cycle = ckpt.get<uint64_t>();
+  this->checkpoint_packets.clear();
+}
+
+
+flit_t* netrace_traffic_eval_t::ingress_tick(uint64_t ingress_id, uint64_t current_cycle,
+					      char ready,
+					      bool gen_packets,
+					      bool count_sent_flits) {
+  std::lock_guard<std::mutex> lock(this->trace_lock);
+  if (gen_packets && current_cycle >= this->next_cycle) {
+    // If idle, fast-forward to next flit
+    if (this->trace_packet != NULL && this->trace_packet->cycle > this->cycle_offset && this->no_inflight_flits() && this->blocked_packets.size() == 0) {
+      this->cycle_offset = this->trace_packet->cycle;
+    }
+
+    // Get packets from tracefile. Packets with outstanding dependencies
+    // block until their last parent finishes, and the rest are ready.
+    while (this->trace_packet != NULL && this->trace_packet->cycle <= current_cycle + this->cycle_offset) {
+      if (dependencies_cleared(this->trace_packet)) {
+	release_packet(this->trace_packet);
+      } else {
+	this->blocked_packets[this->trace_packet->id] = this->trace_packet;
+      }
+      this->trace_packet = read_trace_packet();
+    }
+  }
+
+  // Inject the packets of this ingress that became ready since the last
+  // cycle. Each ingress injects only into its own shard.
+  if (gen_packets) {
+    ring_queue_t<nt_packet_t*>& ready_q = this->ready_queues[ingress_id];
+    while (!ready_q.empty()) {
+      nt_packet_t* packet = ready_q.front();
+      ready_q.pop();
+      // Each packet is tagged with its trace packet, to finish on ejection
+      inject_flits_for_packet(ingress_id, packet->dst, this->flits_per_packet,
+			      count_sent_flits, current_cycle, (uint64_t)(uintptr_t)packet);
+    }
+  }
+
   this->next_cycle = current_cycle + 1;
-  return deq_flit;
+  return dequeue_flit(ingress_id, ready, current_cycle);
 }
 
 void netrace_traffic_eval_t::egress_tick(uint64_t egress_id,
@@ -524,12 +3048,559 @@ void netrace_traffic_eval_t::egress_tick(uint64_t egress_id,
 					 ) {
   *ready = true;
   if (valid) {
-    if (tail) {
-      nt_packet_t* packet = this->nt_packet_map[unique_id];
-      assert(packet);
-      nt_clear_dependencies_free_packet(&this->nt_ctx, packet);
-      this->nt_packet_map.erase(unique_id);
+    // The tail is read before eject_flits retires it, which reports
+    // lost flits
+    flit_t* f = tail && ingress_id < this->num_ingresses ?
+      this->ingress_shards[ingress_id].flits.lookup(unique_id) : NULL;
+    if (f) {
+      std::lock_guard<std::mutex> lock(this->trace_lock);
+      clear_dependencies_free_packet((nt_packet_t*)(uintptr_t)f->tag);
     }
     eject_flits(head, tail, ingress_id, egress_id, unique_id, current_cycle, count_recvd_flits);
   }
 }
+
+
+load_sweep_t::load_sweep_t(runtime_params_t *params, traffic_eval_t *eval) {
+  this->params = params;
+  this->eval = eval;
+  this->scale = params->sweep_start;
+  this->finished = false;
+  this->window_open = false;
+  this->window_network_flits = 0;
+  this->eval->set_load_scale(this->scale);
+}
+
+void load_sweep_t::tick(uint64_t current_cycle) {
+  if (this->finished) {
+    return;
+  }
+  if (this->params->in_drain(current_cycle)) {
+    record_point(current_cycle);
+    if (this->finished) {
+      return;
+    }
+  }
+  // The window opens with the first measured cycle. Fast-forward only
+  // skips the cycles before it with an empty network.
+  if (!this->window_open && current_cycle + 1 >= this->params->warmup_cycles) {
+    this->window_open = true;
+    this->window_network_flits = current_cycle + 1 == this->params->warmup_cycles ? network_flits() : 0;
+  }
+}
+
+int64_t load_sweep_t::network_flits() {
+  return (int64_t)this->eval->num_injected_flits() - (int64_t)this->eval->num_received_flits();
+}
+
+void load_sweep_t::record_point(uint64_t current_cycle) {
+  // Flits still crossing the network when the window closes were
+  // accepted, unlike those backed up at the ingresses
+  uint64_t sent = this->eval->get_window_flits_sent();
+  int64_t accepted = ((int64_t)this->eval->get_window_flits_received() +
+		      network_flits() - this->window_network_flits);
+  accepted = std::max(accepted, (int64_t)0);
+  const latency_hist_t<uint64_t>& latencies = this->eval->get_window_latencies();
+  double cycles = this->params->measurement_cycles * this->params->num_ingresses;
+  sweep_point_t point;
+  point.scale = this->scale;
+  point.offered = sent / cycles;
+  point.accepted = accepted / cycles;
+  point.median_latency = latencies.median();
+  point.p99_latency = latencies.quantile(0.99);
+  point.max_latency = latencies.max();
+  point.saturated = (accepted < this->params->sweep_min_accepted * sent ||
+		     (!this->points.empty() &&
+		      point.median_latency > this->params->sweep_latency_factor * this->points[0].median_latency));
+  this->points.push_back(point);
+  this->eval->reset_window_stats();
+
+  std::cout << "Sweep point " << this->scale
+	    << " offered " << point.offered
+	    << " accepted " << point.accepted
+	    << " median latency " << point.median_latency
+	    << (point.saturated ? " (saturated)" : "") << std::endl;
+
+  // Continue at the next load, or finish and drain. Packets backed up at
+  // a saturated point would take long to drain, and are dropped.
+  this->scale += this->params->sweep_step;
+  if (point.saturated || this->scale > this->params->sweep_stop * (1.0f + 1e-6f)) {
+    this->finished = true;
+    this->eval->flush_ingress_queues();
+    return;
+  }
+  this->eval->set_load_scale(this->scale);
+  this->params->warmup_cycles = current_cycle + this->params->sweep_settle_cycles;
+  this->window_open = false;
+}
+
+void load_sweep_t::print_results(std::ostream& os) {
+  os << "Sweep CSV:" << std::endl;
+  os << "load_scale, offered, accepted, median_latency, p99_latency, max_latency, saturated" << std::endl;
+  for (sweep_point_t& point : this->points) {
+    os << point.scale << ", "
+       << point.offered << ", "
+       << point.accepted << ", "
+       << point.median_latency << ", "
+       << point.p99_latency << ", "
+       << point.max_latency << ", "
+       << point.saturated << std::endl;
+  }
+}
+
+void load_sweep_t::print_json(std::ostream& os) {
+  os << "[";
+  for (size_t i = 0; i < this->points.size(); i++) {
+    sweep_point_t& point = this->points[i];
+    os << (i ? ",\n" : "\n")
+       << "    {\"load_scale\": " << point.scale
+       << ", \"offered\": " << point.offered
+       << ", \"accepted\": " << point.accepted
+       << ", \"median_latency\": " << point.median_latency
+       << ", \"p99_latency\": " << point.p99_latency
+       << ", \"max_latency\": " << point.max_latency
+       << ", \"saturated\": " << (point.saturated ? "true" : "false") << "}";
+  }
+  os << "\n  ]";
+}
+
+
+adaptive_measurement_t::adaptive_measurement_t(runtime_params_t *params, traffic_eval_t *eval) {
+  this->params = params;
+  this->eval = eval;
+  this->max_warmup_cycles = params->warmup_cycles;
+  this->max_measurement_cycles = params->measurement_cycles;
+  this->next_batch_cycle = params->adaptive_batch_cycles;
+  this->measuring = false;
+  this->finished = false;
+
+  // Count flits from the start, so warmup batches can be observed. The
+  // warmup is set to its actual length once it is detected.
+  params->warmup_cycles = 0;
+  params->measurement_cycles = this->max_warmup_cycles + this->max_measurement_cycles;
+
+  // Solve erfc(z / sqrt(2)) = 1 - confidence by bisection
+  double lo = 0.0;
+  double hi = 10.0;
+  for (int i = 0; i < 64; i++) {
+    double mid = (lo + hi) / 2.0;
+    if (std::erfc(mid / std::sqrt(2.0)) > 1.0 - params->adaptive_confidence) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  this->z = lo;
+}
+
+bool adaptive_measurement_t::warmup_done() {
+  // MSER: truncating the first d batches, the statistic
+  // sum((x_i - mean_d)^2) / (n - d)^2 is minimized where the remaining
+  // batches are steady-state. A minimum in the second half means the
+  // transient may not have ended yet.
+  uint64_t n = this->batches.size();
+  if (n < this->params->adaptive_min_batches) {
+    return false;
+  }
+  double best = std::numeric_limits<double>::max();
+  uint64_t best_d = 0;
+  for (uint64_t d = 0; d + 1 < n; d++) {
+    double sum = 0.0;
+    for (uint64_t i = d; i < n; i++) {
+      sum += this->batches[i].mean_latency;
+    }
+    double mean = sum / (n - d);
+    double sq = 0.0;
+    for (uint64_t i = d; i < n; i++) {
+      double dx = this->batches[i].mean_latency - mean;
+      sq += dx * dx;
+    }
+    double mser = sq / ((double)(n - d) * (double)(n - d));
+    if (mser < best) {
+      best = mser;
+      best_d = d;
+    }
+  }
+  return best_d <= n / 2;
+}
+
+adaptive_measurement_t::interval_t adaptive_measurement_t::get_interval(double batch_t::*metric) {
+  interval_t interval;
+  double n = this->batches.size();
+  double sum = 0.0;
+  for (batch_t& batch : this->batches) {
+    sum += batch.*metric;
+  }
+  interval.mean = sum / n;
+  double sq = 0.0;
+  for (batch_t& batch : this->batches) {
+    double dx = batch.*metric - interval.mean;
+    sq += dx * dx;
+  }
+  interval.half_width = n > 1 ? this->z * std::sqrt(sq / (n - 1) / n) : 0.0;
+  return interval;
+}
+
+bool adaptive_measurement_t::interval_converged(double batch_t::*metric) {
+  interval_t interval = get_interval(metric);
+  return interval.half_width <= this->params->adaptive_rel_width * std::abs(interval.mean);
+}
+
+void adaptive_measurement_t::tick(uint64_t current_cycle) {
+  if (this->finished || current_cycle < this->next_batch_cycle) {
+    return;
+  }
+
+  // Record the batch which just ended
+  uint64_t sent = this->eval->get_window_flits_sent();
+  uint64_t received = this->eval->get_window_flits_received();
+  const latency_hist_t<uint64_t>& latencies = this->eval->get_window_latencies();
+  batch_t batch;
+  batch.throughput = sent > 0 ? (double)received / (double)sent : 1.0;
+  batch.mean_latency = latencies.mean();
+  batch.median_latency = latencies.median();
+  batch.p99_latency = latencies.quantile(0.99);
+  this->batches.push_back(batch);
+  this->eval->reset_window_stats();
+  this->next_batch_cycle = current_cycle + this->params->adaptive_batch_cycles;
+
+  if (!this->measuring) {
+    if (warmup_done() || current_cycle >= this->max_warmup_cycles) {
+      // Measure from this cycle, discarding everything counted in warmup
+      this->measuring = true;
+      this->params->warmup_cycles = current_cycle;
+      this->params->measurement_cycles = this->max_measurement_cycles;
+      this->eval->reset_stats();
+      this->batches.clear();
+    }
+    return;
+  }
+
+  if (this->batches.size() >= this->params->adaptive_min_batches &&
+      interval_converged(&batch_t::throughput) &&
+      interval_converged(&batch_t::median_latency) &&
+      interval_converged(&batch_t::p99_latency)) {
+    this->finished = true;
+    this->params->measurement_cycles = current_cycle - this->params->warmup_cycles;
+  } else if (this->params->in_drain(current_cycle)) {
+    this->finished = true;
+  }
+}
+
+void adaptive_measurement_t::print_results(std::ostream& os) {
+  os << "Adaptive warmup cycles: " << this->params->warmup_cycles << std::endl;
+  os << "Adaptive measurement cycles: " << this->params->measurement_cycles
+     << " in " << this->batches.size() << " batches" << std::endl;
+  if (this->batches.empty()) {
+    return;
+  }
+  const char* names[] = { "Throughput", "Median latency", "P99 latency" };
+  double batch_t::*metrics[] = { &batch_t::throughput, &batch_t::median_latency, &batch_t::p99_latency };
+  for (int i = 0; i < 3; i++) {
+    interval_t interval = get_interval(metrics[i]);
+    os << names[i] << " " << (this->params->adaptive_confidence * 100) << "% CI: "
+       << interval.mean << " +- " << interval.half_width
+       << " (relative width " << (interval.mean != 0.0 ? interval.half_width / interval.mean : 0.0) << ")"
+       << std::endl;
+  }
+}
+
+void adaptive_measurement_t::print_json(std::ostream& os) {
+  os << "{\"warmup_cycles\": " << this->params->warmup_cycles
+     << ", \"measurement_cycles\": " << this->params->measurement_cycles
+     << ", \"batches\": " << this->batches.size()
+     << ", \"confidence\": " << this->params->adaptive_confidence;
+  if (!this->batches.empty()) {
+    const char* names[] = { "throughput", "median_latency", "p99_latency" };
+    double batch_t::*metrics[] = { &batch_t::throughput, &batch_t::median_latency, &batch_t::p99_latency };
+    for (int i = 0; i < 3; i++) {
+      interval_t interval = get_interval(metrics[i]);
+      os << ", \"" << names[i] << "\": {\"mean\": " << interval.mean
+	 << ", \"half_width\": " << interval.half_width << "}";
+    }
+  }
+  os << "}";
+}
+
+
+telemetry_t::telemetry_t(runtime_params_t *params, traffic_eval_t *eval) : ring(1024) {
+  this->params = params;
+  this->eval = eval;
+  // Windows stay aligned to the start of the run when resuming from a
+  // checkpoint, from which the counters carry over
+  this->window_start_cycle = params->resume_cycle;
+  this->next_window_cycle = (params->resume_cycle / params->telemetry_window + 1) * params->telemetry_window;
+  this->last_generated = eval->num_generated_flits();
+  this->last_injected = eval->num_injected_flits();
+  this->last_received = eval->num_received_flits();
+  this->finished = false;
+  this->file = fopen(params->telemetry_file.c_str(), params->telemetry_binary ? "wb" : "w");
+  if (!this->file) {
+    std::cout << "Unable to open telemetry file " << params->telemetry_file << std::endl;
+    exit(1);
+  }
+  if (params->telemetry_binary) {
+    telemetry_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.window_cycles = params->telemetry_window;
+    fwrite(&header, sizeof(header), 1, this->file);
+  } else {
+    fprintf(this->file, "start_cycle, generated, injected, received, inflight, queued, median_latency, p99_latency, max_latency\n");
+  }
+  this->eval->enable_telemetry();
+  this->writer = std::thread(&telemetry_t::write_records, this);
+}
+
+void telemetry_t::record_window(uint64_t end_cycle) {
+  uint64_t generated = this->eval->num_generated_flits();
+  uint64_t injected = this->eval->num_injected_flits();
+  uint64_t received = this->eval->num_received_flits();
+  const latency_hist_t<uint64_t>& latencies = this->eval->get_telemetry_latencies();
+  telemetry_record_t record;
+  record.start_cycle = this->window_start_cycle;
+  record.generated = generated - this->last_generated;
+  record.injected = injected - this->last_injected;
+  record.received = received - this->last_received;
+  record.inflight = this->eval->num_inflight_flits();
+  record.queued = this->eval->num_queued_flits();
+  record.median_latency = latencies.median();
+  record.p99_latency = latencies.quantile(0.99);
+  record.max_latency = latencies.max();
+  this->eval->reset_telemetry_latencies();
+  this->last_generated = generated;
+  this->last_injected = injected;
+  this->last_received = received;
+  this->window_start_cycle = end_cycle + 1;
+
+  // The ring only fills if the writer falls a thousand windows behind
+  while (!this->ring.try_push(record)) {
+    std::this_thread::yield();
+  }
+}
+
+void telemetry_t::tick(uint64_t current_cycle) {
+  // Cycles skipped by fast_forward are idle, so the windows they span
+  // are recorded empty
+  while (current_cycle + 1 >= this->next_window_cycle) {
+    record_window(this->next_window_cycle - 1);
+    this->next_window_cycle += this->params->telemetry_window;
+  }
+}
+
+void telemetry_t::finish(uint64_t current_cycle) {
+  if (this->finished) {
+    return;
+  }
+  if (current_cycle >= this->window_start_cycle) {
+    record_window(current_cycle);
+  }
+  this->finished = true;
+  this->writer.join();
+  fclose(this->file);
+}
+
+void telemetry_t::write_records() {
+  telemetry_record_t record;
+  while (true) {
+    // Read the flag first, so records pushed before it was set are drained
+    bool done = this->finished;
+    while (this->ring.try_pop(record)) {
+      if (this->params->telemetry_binary) {
+	fwrite(&record, sizeof(record), 1, this->file);
+      } else {
+	fprintf(this->file, "%llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu\n",
+		(unsigned long long)record.start_cycle,
+		(unsigned long long)record.generated,
+		(unsigned long long)record.injected,
+		(unsigned long long)record.received,
+		(unsigned long long)record.inflight,
+		(unsigned long long)record.queued,
+		(unsigned long long)record.median_latency,
+		(unsigned long long)record.p99_latency,
+		(unsigned long long)record.max_latency);
+      }
+    }
+    if (done) {
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+
+watchdog_t::watchdog_t(runtime_params_t *params, traffic_eval_t *eval) {
+  this->params = params;
+  this->eval = eval;
+  this->check_cycles = std::max(params->watchdog_cycles / 16, (uint64_t)1);
+  this->next_check_cycle = params->resume_cycle;
+  this->last_received = eval->num_received_flits();
+  this->last_progress_cycle = params->resume_cycle;
+}
+
+bool watchdog_t::tick(uint64_t current_cycle) {
+  if (current_cycle < this->next_check_cycle) {
+    return false;
+  }
+  this->next_check_cycle = current_cycle + this->check_cycles;
+
+  // An idle network is not stalled
+  uint64_t received = this->eval->num_received_flits();
+  if (received != this->last_received || this->eval->no_inflight_flits()) {
+    this->last_received = received;
+    this->last_progress_cycle = current_cycle;
+  }
+  uint64_t threshold = this->params->watchdog_cycles;
+  if (current_cycle - this->last_progress_cycle >= threshold) {
+    this->reason = ("no flit received for " + std::to_string(current_cycle - this->last_progress_cycle) +
+		    " cycles, with " + std::to_string(this->eval->num_inflight_flits()) + " flits inflight");
+    return true;
+  }
+  flit_t oldest;
+  if (this->eval->get_oldest_network_flit(oldest) &&
+      current_cycle - oldest.head_departure_cycle >= threshold) {
+    this->reason = ("flit " + std::to_string(oldest.unique_id) + " from ingress " +
+		    std::to_string(oldest.ingress_id) + " to egress " + std::to_string(oldest.egress_id) +
+		    " has been in the network for " +
+		    std::to_string(current_cycle - oldest.head_departure_cycle) + " cycles");
+    return true;
+  }
+  return false;
+}
+
+void watchdog_t::print_diagnostics(std::ostream& os, uint64_t current_cycle) {
+  os << "Watchdog: " << this->reason << " at cycle " << current_cycle << std::endl;
+
+  // The flits of a pair leave their ingress in order, so the first seen
+  // is the oldest
+  typedef std::pair<uint64_t, uint64_t> pair_t;
+  std::map<pair_t, std::pair<flit_t, uint64_t>> pairs;
+  for (const flit_t& flit : this->eval->get_network_flits()) {
+    pair_t pair(flit.ingress_id, flit.egress_id);
+    auto it = pairs.find(pair);
+    if (it == pairs.end()) {
+      pairs[pair] = std::make_pair(flit, (uint64_t)1);
+    } else {
+      it->second.second++;
+    }
+  }
+  std::vector<std::pair<flit_t, uint64_t>> oldest;
+  for (auto& p : pairs) {
+    oldest.push_back(p.second);
+  }
+  std::sort(oldest.begin(), oldest.end(), [](const std::pair<flit_t, uint64_t>& a,
+					     const std::pair<flit_t, uint64_t>& b) {
+    return a.first.head_departure_cycle < b.first.head_departure_cycle;
+  });
+  const uint64_t max_rows = 16;
+  os << "Oldest flits in the network, of " << oldest.size() << " ingress/egress pairs:" << std::endl;
+  os << "ingress_id, egress_id, flits, oldest_unique_id, oldest_network_cycles, oldest_age" << std::endl;
+  for (uint64_t i = 0; i < oldest.size() && i < max_rows; i++) {
+    const flit_t& flit = oldest[i].first;
+    os << flit.ingress_id << ", "
+       << flit.egress_id << ", "
+       << oldest[i].second << ", "
+       << flit.unique_id << ", "
+       << current_cycle - flit.head_departure_cycle << ", "
+       << current_cycle - flit.creation_cycle
+       << std::endl;
+  }
+
+  os << "Ingress queues:" << std::endl;
+  os << "ingress_id, queued_flits" << std::endl;
+  for (uint64_t i = 0; i < this->params->num_ingresses; i++) {
+    uint64_t queued = this->eval->get_queued_flits(i);
+    if (queued > 0) {
+      os << i << ", " << queued << std::endl;
+    }
+  }
+}
+
+router_stats_t::router_stats_t(runtime_params_t *params, const std::string& layout) {
+  this->params = params;
+  this->inputs = 0;
+  std::istringstream tokens(layout);
+  link_t link;
+  uint64_t vcs = 0;
+  while (tokens >> link.src >> link.dst >> link.num_vcs) {
+    bool egress = link.dst[0] == 'e';
+    if (!egress && this->inputs != this->links.size()) {
+      std::cout << "Router stats layout lists input port " << link.src << " " << link.dst
+		<< " after an egress port" << std::endl;
+      exit(1);
+    }
+    link.first_vc = vcs;
+    vcs += link.num_vcs;
+    this->inputs += !egress;
+    this->links.push_back(link);
+  }
+  if (!tokens.eof()) {
+    std::cout << "Malformed router stats layout" << std::endl;
+    exit(1);
+  }
+  this->flits.resize(this->links.size(), 0);
+  this->va_stalls.resize(this->inputs, 0);
+  this->sa_stalls.resize(this->inputs, 0);
+  this->occupancy.resize(vcs, 0);
+  this->last_flits = this->flits;
+  this->last_stalls.resize(this->inputs, 0);
+  this->last_occupancy = this->occupancy;
+  // Windows stay aligned to the start of the run when resuming from a
+  // checkpoint, though the counters start from zero
+  this->next_window_cycle = (params->resume_cycle / params->router_stats_window + 1) * params->router_stats_window;
+  this->file = fopen(params->router_stats_file.c_str(), "w");
+  if (!this->file) {
+    std::cout << "Unable to open router stats file " << params->router_stats_file << std::endl;
+    exit(1);
+  }
+}
+
+void router_stats_t::write_window(uint64_t end_cycle) {
+  unsigned long long cycle = end_cycle;
+  for (uint64_t l = 0; l < this->links.size(); l++) {
+    const char* src = this->links[l].src.c_str();
+    const char* dst = this->links[l].dst.c_str();
+    if (this->flits[l] != this->last_flits[l]) {
+      fprintf(this->file, "nocsample %llu %s %s %llu\n", cycle, src, dst, (unsigned long long)this->flits[l]);
+      this->last_flits[l] = this->flits[l];
+    }
+    if (l < this->inputs && this->va_stalls[l] + this->sa_stalls[l] != this->last_stalls[l]) {
+      fprintf(this->file, "nocstall %llu %s %s %llu %llu\n", cycle, src, dst,
+	      (unsigned long long)this->va_stalls[l], (unsigned long long)this->sa_stalls[l]);
+      this->last_stalls[l] = this->va_stalls[l] + this->sa_stalls[l];
+    }
+    for (uint64_t v = 0; v < this->links[l].num_vcs; v++) {
+      uint64_t i = this->links[l].first_vc + v;
+      if (this->occupancy[i] != this->last_occupancy[i]) {
+	fprintf(this->file, "nococcupancy %llu %s %s %llu %llu\n", cycle, src, dst,
+		(unsigned long long)v, (unsigned long long)this->occupancy[i]);
+	this->last_occupancy[i] = this->occupancy[i];
+      }
+    }
+  }
+}
+
+void router_stats_t::tick(uint64_t current_cycle) {
+  if (!this->file) {
+    return;
+  }
+  // Records are stamped with the cycles elapsed at the end of the window
+  while (current_cycle + 1 >= this->next_window_cycle) {
+    write_window(this->next_window_cycle);
+    this->next_window_cycle += this->params->router_stats_window;
+  }
+}
+
+void router_stats_t::finish(uint64_t current_cycle) {
+  std::lock_guard<std::mutex> lock(this->lock);
+  if (!this->file) {
+    return;
+  }
+  tick(current_cycle);
+  if (current_cycle + 1 > this->next_window_cycle - this->params->router_stats_window) {
+    write_window(current_cycle + 1);
+  }
+  fclose(this->file);
+  this->file = NULL;
+}
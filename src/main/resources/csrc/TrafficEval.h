@@ -8,34 +8,674 @@
 #include <list>
 #include <map>
 #include <random>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <cmath>
+#include <ostream>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
 #include <cassert>
+#include <type_traits>
 
 extern "C" {
 #include "netrace.h"
 }
+#include "TraceBinary.h"
 
 class flit_t
 {
 public:
+ flit_t() { }
  flit_t(bool head, bool tail,
 	uint64_t ingress_id, uint64_t egress_id,
 	int64_t unique_id, uint64_t creation_cycle)
-   : head(head), tail(tail), ingress_id(ingress_id), egress_id(egress_id), unique_id(unique_id), creation_cycle(creation_cycle) { }
+   : head(head), tail(tail), traffic_class(0), ingress_id(ingress_id), egress_id(egress_id),
+     unique_id(unique_id), creation_cycle(creation_cycle), head_departure_cycle(creation_cycle), tag(0) { }
 
   bool head;
   bool tail;
+  // Traffic class of this flit's packet, 0 for the default class
+  uint32_t traffic_class;
   uint64_t ingress_id;
   uint64_t egress_id;
   uint64_t unique_id;
   uint64_t creation_cycle;
+  // Cycle the head flit of this flit's packet left the ingress queue
+  uint64_t head_departure_cycle;
+  // Tag of this flit's packet, defined by the traffic model
+  uint64_t tag;
 };
 
+// Growable FIFO backed by a power-of-two ring. Once it has grown to the
+// steady-state depth, push and pop never allocate.
+template <typename T>
+class ring_queue_t
+{
+public:
+  ring_queue_t(uint64_t capacity = 16) : buf(capacity), mask(capacity - 1), head(0), tail(0) {
+    assert((capacity & mask) == 0);
+  }
+
+  void push(const T& v) {
+    if (tail - head == buf.size()) { grow(); }
+    buf[tail++ & mask] = v;
+  }
+  T& front() { return buf[head & mask]; }
+  void pop() { head++; }
+  uint64_t size() { return tail - head; }
+  bool empty() { return tail == head; }
+
+private:
+  void grow() {
+    std::vector<T> next(buf.size() * 2);
+    for (uint64_t i = head; i < tail; i++) {
+      next[i - head] = buf[i & mask];
+    }
+    tail -= head;
+    head = 0;
+    buf.swap(next);
+    mask = buf.size() - 1;
+  }
+
+  std::vector<T> buf;
+  uint64_t mask;
+  uint64_t head;
+  uint64_t tail;
+};
+
+// Bounded lock-free queue between one producer and one consumer thread.
+// Each side owns one index, which it publishes with a release store after
+// writing or reading the slot.
+template <typename T>
+class spsc_ring_t
+{
+public:
+  spsc_ring_t(uint64_t capacity) : buf(capacity), mask(capacity - 1), head(0), tail(0) {
+    assert(capacity > 0 && (capacity & mask) == 0);
+  }
+
+  bool try_push(const T& v) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == buf.size()) { return false; }
+    buf[t & mask] = v;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  bool try_pop(T& v) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) { return false; }
+    v = buf[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::vector<T> buf;
+  uint64_t mask;
+  // Separate cache lines, so the two sides do not contend
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+};
+
+// Binary checkpoint files. Values are written as their bytes in host
+// order, so a checkpoint is only restored by the build which saved it.
+#define CHECKPOINT_MAGIC   0x50434e43 // "CNCP"
+#define CHECKPOINT_VERSION 3
+
+typedef struct checkpoint_header_t {
+  uint32_t magic;
+  uint32_t version;
+  // Traffic model, or the simulator whose state follows
+  uint32_t model;
+  uint32_t reserved;
+  uint64_t num_ingresses;
+  uint64_t num_egresses;
+  // Last cycle simulated before the checkpoint
+  uint64_t cycle;
+} checkpoint_header_t;
+
+static_assert(sizeof(checkpoint_header_t) == 40, "checkpoint_header_t layout");
+
+class checkpoint_writer_t
+{
+public:
+  checkpoint_writer_t(const std::string& path) : file(fopen(path.c_str(), "wb")), ok(file != NULL) { }
+  ~checkpoint_writer_t() { close(); }
+
+  template <typename T>
+  void put(const T& v) {
+    static_assert(std::is_trivially_copyable<T>::value, "checkpointed values are copied as bytes");
+    write(&v, sizeof(T));
+  }
+  template <typename T>
+  void put_vector(const std::vector<T>& v) {
+    static_assert(std::is_trivially_copyable<T>::value, "checkpointed values are copied as bytes");
+    put<uint64_t>(v.size());
+    write(v.data(), v.size() * sizeof(T));
+  }
+  template <typename T>
+  void put_queue(ring_queue_t<T> q) {
+    std::vector<T> v;
+    for (; !q.empty(); q.pop()) { v.push_back(q.front()); }
+    put_vector(v);
+  }
+  // Returns false if the file could not be opened or written
+  bool close() {
+    if (file) {
+      ok = fclose(file) == 0 && ok;
+      file = NULL;
+    }
+    return ok;
+  }
+
+private:
+  void write(const void* p, size_t n) {
+    ok = ok && (n == 0 || fwrite(p, n, 1, file) == 1);
+  }
+
+  FILE* file;
+  bool ok;
+};
+
+// Reads a checkpoint written by checkpoint_writer_t. Reads past the end of
+// the file, or of vectors longer than the rest of the file, fail and
+// return zeroed values, so a malformed checkpoint is reported by fail()
+// rather than by large allocations.
+class checkpoint_reader_t
+{
+public:
+  checkpoint_reader_t(const std::string& path) : file(fopen(path.c_str(), "rb")), ok(file != NULL), remaining(0) {
+    if (file && fseek(file, 0, SEEK_END) == 0) {
+      long size = ftell(file);
+      remaining = size > 0 ? size : 0;
+      fseek(file, 0, SEEK_SET);
+    }
+  }
+  ~checkpoint_reader_t() {
+    if (file) { fclose(file); }
+  }
+
+  template <typename T>
+  T get() {
+    static_assert(std::is_trivially_copyable<T>::value, "checkpointed values are copied as bytes");
+    T v;
+    memset((void*)&v, 0, sizeof(T));
+    read(&v, sizeof(T));
+    return v;
+  }
+  template <typename T>
+  std::vector<T> get_vector() {
+    static_assert(std::is_trivially_copyable<T>::value, "checkpointed values are copied as bytes");
+    uint64_t n = get<uint64_t>();
+    if (n > remaining / std::max(sizeof(T), (size_t)1)) {
+      ok = false;
+      n = 0;
+    }
+    std::vector<T> v(n);
+    read(v.data(), n * sizeof(T));
+    return v;
+  }
+  template <typename T>
+  void get_queue(ring_queue_t<T>& q) {
+    for (const T& item : get_vector<T>()) { q.push(item); }
+  }
+  bool fail() { return !ok; }
+  bool at_end() { return ok && remaining == 0; }
+
+private:
+  void read(void* p, size_t n) {
+    if (n == 0) { return; }
+    ok = ok && n <= remaining && fread(p, n, 1, file) == 1;
+    remaining = ok ? remaining - n : 0;
+  }
+
+  FILE* file;
+  bool ok;
+  uint64_t remaining;
+};
+
+// Inflight flits of one ingress, indexed by the sequence number in the
+// low SEQ_BITS of their unique ids. The ingress writes each flit before
+// sending it, and the egress which receives it reads and retires it. Flits are stored
+// in fixed chunks which stay in place while any of their flits are
+// inflight, so egresses never race with the ingress adding chunks. The
+// ingress recycles the oldest chunk once all of its flits have retired.
+// Chunks are found through a ring directory, which the ingress doubles
+// when more chunks are live than it holds. Replaced directories are kept
+// until the arena is destroyed, as egresses may still be reading them.
+class flit_arena_t
+{
+public:
+  enum {
+    SEQ_BITS = 40,
+    CHUNK_BITS = 8,
+    CHUNK_SIZE = 1 << CHUNK_BITS,
+    // Chunks held by a new directory
+    MIN_DIRECTORY_SIZE = 16
+  };
+
+  flit_arena_t() : next(0), oldest(0) {
+    directories.push_back(new directory_t(MIN_DIRECTORY_SIZE));
+    directory.store(directories.back(), std::memory_order_relaxed);
+  }
+  ~flit_arena_t() {
+    directory_t* dir = directory.load(std::memory_order_relaxed);
+    for (uint64_t i = 0; i < dir->size(); i++) {
+      delete dir->slots[i].load(std::memory_order_relaxed);
+    }
+    for (chunk_t* chunk : free_chunks) {
+      delete chunk;
+    }
+    for (directory_t* d : directories) {
+      delete d;
+    }
+  }
+  flit_arena_t(const flit_arena_t&) = delete;
+  flit_arena_t& operator=(const flit_arena_t&) = delete;
+
+  // Sequence number of the next flit, called by the owning ingress
+  uint64_t next_seq() { return next.load(std::memory_order_relaxed); }
+  // Adds the flit with the next sequence number, called by the owning ingress
+  flit_t* insert(const flit_t& flit) {
+    uint64_t seq = flit.unique_id & SEQ_MASK;
+    assert(seq == next.load(std::memory_order_relaxed));
+    if ((seq & CHUNK_MASK) == 0) { add_chunk(seq >> CHUNK_BITS); }
+    chunk_t* chunk = owned_chunk(seq);
+    record_t* record = &chunk->records[seq & CHUNK_MASK];
+    record->flit = flit;
+    record->live.store(true, std::memory_order_release);
+    next.store(seq + 1, std::memory_order_release);
+    return &record->flit;
+  }
+  flit_t* lookup(uint64_t unique_id) {
+    uint64_t seq = unique_id & SEQ_MASK;
+    chunk_t* chunk = shared_chunk(seq);
+    if (!chunk) { return NULL; }
+    record_t* record = &chunk->records[seq & CHUNK_MASK];
+    if (!record->live.load(std::memory_order_acquire) || record->flit.unique_id != unique_id) {
+      return NULL;
+    }
+    return &record->flit;
+  }
+  void erase(flit_t* flit) {
+    record_t* record = reinterpret_cast<record_t*>(flit);
+    assert(record->live.load(std::memory_order_relaxed));
+    record->live.store(false, std::memory_order_release);
+  }
+
+  // Copies the live flit with the lowest sequence number, returning false
+  // if there is none. Other threads may call this, and see a recent state.
+  bool oldest_live(flit_t& flit) {
+    uint64_t end = next.load(std::memory_order_acquire);
+    for (uint64_t seq = oldest.load(std::memory_order_relaxed) << CHUNK_BITS; seq < end; seq++) {
+      if (copy_live(seq, flit)) { return true; }
+    }
+    return false;
+  }
+  // Copies every live flit, in sequence order
+  void live_flits(std::vector<flit_t>& flits) {
+    uint64_t end = next.load(std::memory_order_acquire);
+    flit_t flit;
+    for (uint64_t seq = oldest.load(std::memory_order_relaxed) << CHUNK_BITS; seq < end; seq++) {
+      if (copy_live(seq, flit)) { flits.push_back(flit); }
+    }
+  }
+  // Refills an empty arena with the live flits of a checkpoint, in
+  // sequence order, below the next sequence number next_seq
+  void restore(uint64_t next_seq, const std::vector<flit_t>& flits) {
+    assert(next.load(std::memory_order_relaxed) == 0);
+    uint64_t first = (flits.empty() ? next_seq : flits.front().unique_id & SEQ_MASK) >> CHUNK_BITS;
+    // The chunk starting at next_seq is added by the next insert
+    uint64_t end = (next_seq + CHUNK_MASK) >> CHUNK_BITS;
+    for (uint64_t index = first; index < end; index++) {
+      alloc_chunk(index, first);
+    }
+    oldest.store(first, std::memory_order_relaxed);
+    for (const flit_t& flit : flits) {
+      uint64_t seq = flit.unique_id & SEQ_MASK;
+      assert(seq < next_seq && (seq >> CHUNK_BITS) >= first);
+      chunk_t* chunk = owned_chunk(seq);
+      record_t* record = &chunk->records[seq & CHUNK_MASK];
+      record->flit = flit;
+      record->live.store(true, std::memory_order_release);
+    }
+    next.store(next_seq, std::memory_order_release);
+  }
+
+private:
+  enum {
+    CHUNK_MASK = CHUNK_SIZE - 1
+  };
+  static const uint64_t SEQ_MASK = ((uint64_t)1 << SEQ_BITS) - 1;
+
+  struct record_t {
+    record_t() : live(false) { }
+    // First, so a flit_t* is also its record_t*
+    flit_t flit;
+    std::atomic<bool> live;
+  };
+  struct chunk_t {
+    record_t records[CHUNK_SIZE];
+  };
+  // Ring of chunks, indexed by the low bits of the chunk index
+  struct directory_t {
+    directory_t(uint64_t size) : mask(size - 1), slots(new std::atomic<chunk_t*>[size]) {
+      for (uint64_t i = 0; i < size; i++) {
+	slots[i].store(NULL, std::memory_order_relaxed);
+      }
+    }
+    ~directory_t() { delete[] slots; }
+    uint64_t size() { return mask + 1; }
+    std::atomic<chunk_t*>& slot(uint64_t index) { return slots[index & mask]; }
+    uint64_t mask;
+    std::atomic<chunk_t*>* slots;
+  };
+
+  // Chunk holding a sequence number, as seen by the owning ingress, and by
+  // other threads
+  chunk_t* owned_chunk(uint64_t seq) {
+    return directory.load(std::memory_order_relaxed)->slot(seq >> CHUNK_BITS).load(std::memory_order_relaxed);
+  }
+  chunk_t* shared_chunk(uint64_t seq) {
+    return directory.load(std::memory_order_acquire)->slot(seq >> CHUNK_BITS).load(std::memory_order_acquire);
+  }
+  bool copy_live(uint64_t seq, flit_t& flit) {
+    chunk_t* chunk = shared_chunk(seq);
+    if (!chunk) { return false; }
+    record_t* record = &chunk->records[seq & CHUNK_MASK];
+    if (!record->live.load(std::memory_order_acquire)) { return false; }
+    flit = record->flit;
+    // A record recycled while being copied holds a later flit
+    return (flit.unique_id & SEQ_MASK) == seq;
+  }
+  bool retired(chunk_t* chunk) {
+    for (uint64_t i = 0; i < CHUNK_SIZE; i++) {
+      if (chunk->records[i].live.load(std::memory_order_acquire)) { return false; }
+    }
+    return true;
+  }
+  void add_chunk(uint64_t index) {
+    uint64_t first = oldest.load(std::memory_order_relaxed);
+    directory_t* dir = directory.load(std::memory_order_relaxed);
+    while (first < index) {
+      std::atomic<chunk_t*>& slot = dir->slot(first);
+      if (!retired(slot.load(std::memory_order_relaxed))) { break; }
+      free_chunks.push_back(slot.load(std::memory_order_relaxed));
+      slot.store(NULL, std::memory_order_release);
+      first++;
+    }
+    oldest.store(first, std::memory_order_relaxed);
+    alloc_chunk(index, first);
+  }
+  void alloc_chunk(uint64_t index, uint64_t first) {
+    directory_t* dir = directory.load(std::memory_order_relaxed);
+    if (index - first >= dir->size()) {
+      uint64_t size = dir->size();
+      while (index - first >= size) {
+	size *= 2;
+      }
+      directory_t* grown = new directory_t(size);
+      for (uint64_t i = first; i < index; i++) {
+	grown->slot(i).store(dir->slot(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+      directories.push_back(grown);
+      directory.store(grown, std::memory_order_release);
+      dir = grown;
+    }
+    chunk_t* chunk;
+    if (free_chunks.empty()) {
+      chunk = new chunk_t;
+    } else {
+      chunk = free_chunks.back();
+      free_chunks.pop_back();
+    }
+    dir->slot(index).store(chunk, std::memory_order_release);
+  }
+
+  std::atomic<directory_t*> directory;
+  // Every directory allocated, including those replaced by a larger one
+  std::vector<directory_t*> directories;
+  std::vector<chunk_t*> free_chunks;
+  // Next sequence number, and index of the oldest chunk in the directory,
+  // written by the owning ingress and read by oldest_live
+  std::atomic<uint64_t> next;
+  std::atomic<uint64_t> oldest;
+};
+
+// Streaming latency histogram with fixed-size storage. Latencies below
+// 2^LINEAR_BITS are counted exactly. Larger latencies fall into log-spaced
+// buckets, 2^SUB_BITS per power of two, so tail quantiles carry at most
+// 1/2^SUB_BITS relative error. Bucket storage is allocated on the first
+// record, so flows which never see traffic cost nothing.
+template <typename count_t>
+class latency_hist_t
+{
+public:
+  enum {
+    LINEAR_BITS = 7,
+    SUB_BITS = 4,
+    MAX_BITS = 32,
+    NUM_BUCKETS = (1 << LINEAR_BITS) + (MAX_BITS - LINEAR_BITS) * (1 << SUB_BITS)
+  };
+
+  latency_hist_t() : total(0), sum(0), max_value(0) { }
+
+  void record(uint64_t latency) {
+    if (buckets.empty()) { buckets.resize(NUM_BUCKETS); }
+    buckets[bucket_of(latency)]++;
+    total++;
+    sum += latency;
+    max_value = std::max(max_value, latency);
+  }
+  template <typename T>
+  void merge(const latency_hist_t<T>& other) {
+    if (other.count() == 0) { return; }
+    if (buckets.empty()) { buckets.resize(NUM_BUCKETS); }
+    for (uint64_t i = 0; i < NUM_BUCKETS; i++) {
+      buckets[i] += other.bucket_count(i);
+    }
+    total += other.count();
+    sum += other.get_sum();
+    max_value = std::max(max_value, other.max());
+  }
+  void clear() {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    total = 0;
+    sum = 0;
+    max_value = 0;
+  }
+
+  uint64_t count() const { return total; }
+  uint64_t get_sum() const { return sum; }
+  uint64_t max() const { return max_value; }
+  double mean() const { return total > 0 ? (double)sum / (double)total : 0.0; }
+  // Smallest recorded latency L such that a fraction q of samples are <= L.
+  // Inexact buckets report their upper bound.
+  uint64_t quantile(double q) const {
+    if (total == 0) { return 0; }
+    uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(q * total));
+    uint64_t running = 0;
+    for (uint64_t i = 0; i < NUM_BUCKETS; i++) {
+      running += buckets[i];
+      if (running >= rank) {
+	return std::min(bucket_high(i) - 1, max_value);
+      }
+    }
+    return max_value;
+  }
+  uint64_t median() const { return quantile(0.5); }
+
+  count_t bucket_count(uint64_t i) const { return buckets.empty() ? 0 : buckets[i]; }
+  // Inclusive lower and exclusive upper latency bound of bucket i
+  static uint64_t bucket_low(uint64_t i) {
+    if (i < (1 << LINEAR_BITS)) { return i; }
+    uint64_t msb = LINEAR_BITS + ((i - (1 << LINEAR_BITS)) >> SUB_BITS);
+    uint64_t sub = (i - (1 << LINEAR_BITS)) & ((1 << SUB_BITS) - 1);
+    return ((uint64_t)1 << msb) | (sub << (msb - SUB_BITS));
+  }
+  static uint64_t bucket_high(uint64_t i) {
+    if (i < (1 << LINEAR_BITS)) { return i + 1; }
+    uint64_t msb = LINEAR_BITS + ((i - (1 << LINEAR_BITS)) >> SUB_BITS);
+    return bucket_low(i) + ((uint64_t)1 << (msb - SUB_BITS));
+  }
+  static uint64_t bucket_of(uint64_t latency) {
+    if (latency < (1 << LINEAR_BITS)) { return latency; }
+    uint64_t msb = 63 - __builtin_clzll(latency);
+    if (msb >= MAX_BITS) { return NUM_BUCKETS - 1; }
+    uint64_t sub = (latency >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return (1 << LINEAR_BITS) + ((msb - LINEAR_BITS) << SUB_BITS) + sub;
+  }
+
+private:
+  std::vector<count_t> buckets;
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max_value;
+};
+
+// Latencies of whole packets, from creation to the ejection of the tail,
+// split into queueing until the head leaves the ingress queue, and the
+// remainder in the network
+template <typename count_t>
+class packet_latencies_t
+{
+public:
+  void record(uint64_t queueing, uint64_t network) {
+    total.record(queueing + network);
+    this->queueing.record(queueing);
+    this->network.record(network);
+  }
+  template <typename T>
+  void merge(const packet_latencies_t<T>& other) {
+    total.merge(other.total);
+    queueing.merge(other.queueing);
+    network.merge(other.network);
+  }
+  void clear() {
+    total.clear();
+    queueing.clear();
+    network.clear();
+  }
+
+  latency_hist_t<count_t> total;
+  latency_hist_t<count_t> queueing;
+  latency_hist_t<count_t> network;
+};
+
+/* Process generating the packet arrivals of a flow */
+typedef struct injection_process_t {
+  enum kind_t {
+    /* A packet each cycle with fixed probability */
+    BERNOULLI,
+    /* Geometric-length bursts of back-to-back packets, separated by
+       geometric off periods (two-state MMPP) */
+    ONOFF,
+    /* As ONOFF, with Pareto-distributed burst and off lengths */
+    PARETO
+  } kind;
+  /* Mean number of packets per burst */
+  float mean_burst;
+  /* Pareto shape, in (1, 2) for heavy-tailed, self-similar traffic */
+  float alpha;
+} injection_process_t;
+
+/* Distribution of the number of flits in a flow's packets */
+typedef struct packet_size_t {
+  enum kind_t {
+    /* Always min flits */
+    FIXED,
+    /* Uniform in [min, max] flits */
+    UNIFORM,
+    /* min flits with probability prob_min, otherwise max */
+    BIMODAL
+  } kind;
+  uint64_t min;
+  uint64_t max;
+  float prob_min;
+
+  double mean() const {
+    switch (kind) {
+    case UNIFORM: return (min + max) / 2.0;
+    case BIMODAL: return prob_min * min + (1.0 - prob_min) * max;
+    default: return min;
+    }
+  }
+} packet_size_t;
+
 typedef struct flow_rate_t {
   uint64_t ingress_id;
   uint64_t egress_id;
   float rate;
+  injection_process_t process;
+  packet_size_t size;
+  /* Index into runtime_params_t::traffic_classes */
+  uint64_t traffic_class;
 } flow_rate_t;
 
+// Counter-based random stream. Each draw hashes the stream's key with the
+// cycle of the event being sampled and the index of the draw within that
+// event, rather than advancing shared generator state. A flow's draws thus
+// depend only on the seed and its own events, and not on the draws of
+// other flows or the order in which terminals are ticked.
+typedef struct rng_stream_t {
+  uint64_t key;
+  uint64_t cycle;
+  uint64_t index;
+
+  // SplitMix64 finalizer
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  void init(uint64_t seed, uint64_t ingress_id, uint64_t flow_id) {
+    key = mix(mix(seed) ^ ((ingress_id << 32) | flow_id));
+    cycle = std::numeric_limits<uint64_t>::max();
+    index = 0;
+  }
+  // Keys the following draws by the cycle of the event they belong to
+  void seek(uint64_t event_cycle) {
+    if (event_cycle != cycle) {
+      cycle = event_cycle;
+      index = 0;
+    }
+  }
+  uint64_t next() {
+    return mix(key + mix((cycle << 16) ^ index++));
+  }
+  // Uniform in [0, 1)
+  double uniform() {
+    return (next() >> 11) * (1.0 / (double)((uint64_t)1 << 53));
+  }
+} rng_stream_t;
+
+// Generator state of one flow's injection process. Packets are generated
+// as discrete events, each of which schedules the cycle of the next.
+typedef struct injection_state_t {
+  uint64_t egress_id;
+  rng_stream_t rng;
+  injection_process_t process;
+  packet_size_t size;
+  // BERNOULLI: log(1-p) for per-cycle packet probability p.
+  // ONOFF: log(1-q) for per-packet burst end probability q.
+  // PARETO: scale of the burst length distribution.
+  double burst_param;
+  // ONOFF: log(1-r) for per-cycle off to on probability r.
+  // PARETO: scale of the off length distribution.
+  double off_param;
+  // Packets left in the current burst
+  uint64_t burst_remaining;
+  // Traffic class of the flow's packets
+  uint32_t traffic_class;
+} injection_state_t;
+
 
 
 class runtime_params_t
@@ -57,6 +697,44 @@ public:
   std::vector<flow_rate_t> flow_rates;
   /* Static number of flits per packet. */
   uint64_t flits_per_packet;
+  /* Seed of the synthetic traffic. Each flow draws from its own stream,
+     so a given seed reproduces the same traffic in any DPI mode. */
+  uint64_t seed;
+  /* Default injection process and packet size of flows and patterns.
+     The packet size defaults to flits_per_packet. */
+  injection_process_t injection_process;
+  packet_size_t packet_size;
+
+  /* Maximum packets queued at each ingress, 0 for unbounded. Packets
+     generated into a full queue are dropped, or with
+     source_queue_throttle, held back at the generator until the queue
+     has room. */
+  uint64_t source_queue_limit;
+  bool source_queue_throttle;
+
+  /* Abort the run, in any phase, once no flit has been received for
+     watchdog_cycles while flits are inflight, or a flit has been in the
+     network for watchdog_cycles. 0 disables. */
+  uint64_t watchdog_cycles;
+
+  /* Save the traffic state to checkpoint_save_file at the end of
+     checkpoint_save_cycle, which must be in warmup, or restore it from
+     checkpoint_restore_file at init_eval. Statistics are not saved.
+     With checkpoint_save_idle, the save is deferred to the first cycle
+     from checkpoint_save_cycle with no flits in the network. */
+  uint64_t checkpoint_save_cycle;
+  bool checkpoint_save_idle;
+  std::string checkpoint_save_file;
+  std::string checkpoint_restore_file;
+  /* First cycle simulated, following the restored checkpoint. Set by
+     init_eval. */
+  uint64_t resume_cycle;
+
+  /* Optional path to write the results to as JSON */
+  std::string results_file;
+  /* Also record per-packet latencies, split into source queueing and
+     network latency, per flow */
+  bool packet_stats;
 
   float required_throughput;
   uint64_t required_median_latency;
@@ -68,6 +746,75 @@ public:
   std::string netrace_trace;
 
   bool netrace_ignore_dependencies;
+  /* Packets decoded ahead of the simulation by a background thread. 0
+     decodes the trace on the simulation thread. */
+  uint64_t netrace_prefetch;
+
+  /* Built-in synthetic traffic pattern, used instead of explicit flows */
+  std::string pattern;
+  /* Injection rate of each ingress under the pattern, in flits/cycle */
+  float pattern_rate;
+  /* Radix k of the k-ary n-cube used by transpose, tornado and neighbor */
+  uint64_t pattern_radix;
+  /* Fraction of hotspot pattern traffic sent to the hotspot egresses */
+  float hotspot_fraction;
+  std::vector<uint64_t> hotspot_egresses;
+
+  /* Sweep the offered load within one run, as a scale on every flow rate
+     or the pattern rate, from sweep_start to sweep_stop in sweep_step
+     increments. Each point measures for measurement_cycles, after
+     sweep_settle_cycles to reach steady-state at the new load. */
+  bool sweep_enable;
+  float sweep_start;
+  float sweep_stop;
+  float sweep_step;
+  uint64_t sweep_settle_cycles;
+  /* The sweep stops at the first saturated point, where median latency
+     exceeds sweep_latency_factor times that of the first point, or the
+     accepted load falls below sweep_min_accepted of the offered load */
+  float sweep_latency_factor;
+  float sweep_min_accepted;
+  /* Optional path to write the load-latency CSV to */
+  std::string sweep_file;
+
+  /* Adaptive phases, splitting the run into batches of adaptive_batch_cycles.
+     Warmup and measurement_cycles become upper bounds. Measurement ends
+     once the confidence intervals of throughput, median and p99 latency
+     are narrower than adaptive_rel_width of their means. */
+  bool adaptive_enable;
+  uint64_t adaptive_batch_cycles;
+  float adaptive_rel_width;
+  float adaptive_confidence;
+  uint64_t adaptive_min_batches;
+
+  /* Report the next cycle with any activity to the batched harness, which
+     skips the idle cycles before it */
+  bool fast_forward;
+
+  /* Record traffic counters over windows of telemetry_window cycles into
+     telemetry_file, as CSV or as binary telemetry_record_t records */
+  uint64_t telemetry_window;
+  std::string telemetry_file;
+  bool telemetry_binary;
+
+  /* Accumulate the per-link flit, stall and buffer occupancy counters of
+     the routers, and write them into router_stats_file every
+     router_stats_window cycles. 0 disables. */
+  uint64_t router_stats_window;
+  std::string router_stats_file;
+
+  /* Closed-loop request/response traffic. Each ingress keeps at most
+     request_window requests outstanding, and the egress receiving a
+     request replies with a reply_flits packet after service_latency
+     cycles. 0 disables. */
+  uint64_t request_window;
+  uint64_t reply_flits;
+  uint64_t service_latency;
+
+  /* Names of the traffic classes of the flows, starting with the default
+     class. Flows inherit the injection process and packet size of their
+     class, and every class reports its own statistics. */
+  std::vector<std::string> traffic_classes;
 
   bool in_warmup(uint64_t cycle) {
     return cycle < warmup_cycles;
@@ -85,6 +832,12 @@ public:
   }
 };
 
+// State is sharded by terminal. Each ingress_tick writes only its
+// ingress's shard, and each egress_tick only its egress's shard, plus
+// retiring the received flit in its ingress's arena. Ticks of different
+// terminals are therefore safe to run concurrently, as under Verilator
+// --threads with per-terminal DPI calls. Statistics are merged from the
+// shards when read, which must not race with the ticks.
 class traffic_eval_t
 {
 public:
@@ -99,87 +852,252 @@ public:
 			   uint64_t ingress_id, uint64_t unique_id,
 			   uint64_t current_cycle, bool count_recvd_flits
 		   ) = 0;
+  // Returns the next cycle at which the model generates a packet, when no
+  // flits are inflight. Cycles before it are idle and may be skipped.
+  virtual uint64_t next_event_cycle(uint64_t current_cycle) { return current_cycle + 1; };
   void reset_packets_received();
-  bool no_inflight_flits() { return inflight_flits.empty(); };
-  uint64_t num_inflight_flits() { return inflight_flits.size(); };
+  // Sums the flits generated and neither flushed nor received over the
+  // shards, once per cycle after every terminal has ticked
+  virtual void count_inflight_flits();
+  // Flits inflight as of the last count
+  bool no_inflight_flits() { return num_inflight_flits() == 0; };
+  uint64_t num_inflight_flits() { return this->inflight_flits.load(std::memory_order_relaxed); };
 
   uint64_t get_flits_received(flow_rate_t& flow) {
-    return this->flits_received[flow.ingress_id][flow.egress_id];
+    return this->egress_shards[flow.egress_id].flits_received[flow.ingress_id];
   };
   uint64_t get_flits_sent(flow_rate_t& flow) {
-    return this->flits_sent[flow.ingress_id][flow.egress_id];
+    return this->ingress_shards[flow.ingress_id].flits_sent[flow.egress_id];
   };
   uint64_t get_max_latency(flow_rate_t& flow) {
-    if (this->get_flits_received(flow) > 0) {
-      return this->latencies_by_flow[flow.ingress_id][flow.egress_id].rbegin()->first;
-    } else {
-      return 0;
-    }
+    return this->egress_shards[flow.egress_id].latencies_by_ingress[flow.ingress_id].max();
   };
   uint64_t get_overall_max_latency() {
-    if (this->total_flits_received > 0) {
-      return this->latencies.rbegin()->first;
-    } else {
-      return 0;
-    }
+    return get_overall_latencies().max();
   };
   uint64_t get_median_latency(flow_rate_t& flow) {
-    return this->get_median(this->latencies_by_flow[flow.ingress_id][flow.egress_id],
-			    this->flits_received[flow.ingress_id][flow.egress_id]);
+    return this->egress_shards[flow.egress_id].latencies_by_ingress[flow.ingress_id].median();
   };
   uint64_t get_overall_median_latency() {
-    return this->get_median(this->latencies,
-			    this->total_flits_received);
+    return get_overall_latencies().median();
   };
-  uint64_t get_overall_latency_count(uint64_t latency) {
-    if (this->latencies.find(latency) == this->latencies.end()) {
-      return 0;
-    }
-    return this->latencies[latency];
-  }
+  uint64_t get_latency_quantile(flow_rate_t& flow, double q) {
+    return this->egress_shards[flow.egress_id].latencies_by_ingress[flow.ingress_id].quantile(q);
+  };
+  uint64_t get_overall_latency_quantile(double q) {
+    return get_overall_latencies().quantile(q);
+  };
+  const latency_hist_t<uint64_t>& get_overall_latencies();
+  // Packet latencies, recorded with packet_stats
+  const packet_latencies_t<uint32_t>& get_packet_latencies(flow_rate_t& flow) {
+    return this->egress_shards[flow.egress_id].packet_latencies_by_ingress[flow.ingress_id];
+  };
+  const packet_latencies_t<uint64_t>& get_overall_packet_latencies();
+  // Statistics by traffic class, recorded only when flows are split into
+  // more than the default class
+  uint64_t get_num_classes() { return this->num_classes; };
+  uint64_t get_class_flits_sent(uint64_t traffic_class);
+  uint64_t get_class_flits_received(uint64_t traffic_class);
+  const latency_hist_t<uint64_t>& get_class_latencies(uint64_t traffic_class);
+  const packet_latencies_t<uint64_t>& get_class_packet_latencies(uint64_t traffic_class);
+  // Flows which sent or received any flits
+  std::vector<flow_rate_t> get_active_flows();
+
+  // Scales the offered load of every flow, for load sweeps. Generation
+  // restarts at the new rates from the next tick.
+  virtual void set_load_scale(float);
+  // Drops the queued packets which have not begun injection
+  virtual void flush_ingress_queues();
+  // Clears all counted flits and latencies
+  virtual void reset_stats();
+  // Stops background work once the run is decided
+  virtual void finish() {};
+
+  // Statistics of the flits counted since the last reset_window_stats
+  uint64_t get_window_flits_sent();
+  uint64_t get_window_flits_received();
+  const latency_hist_t<uint64_t>& get_window_latencies();
+  void reset_window_stats();
+
+  // Flits generated, waiting in ingress queues, sent into the network and
+  // received since the start of the run, in any phase
+  uint64_t num_generated_flits();
+  uint64_t num_queued_flits();
+  uint64_t num_injected_flits();
+  uint64_t num_received_flits();
+  // Latencies of the flits received since the last reset, in any phase,
+  // recorded once enabled
+  void enable_telemetry() { this->telemetry_enabled = true; };
+  const latency_hist_t<uint64_t>& get_telemetry_latencies();
+  void reset_telemetry_latencies();
+
+  // Load offered to an ingress but not accepted into its bounded source
+  // queue, as flits dropped or cycles throttled
+  uint64_t get_ingress_flits_sent(uint64_t ingress_id);
+  uint64_t get_flits_dropped(uint64_t ingress_id) {
+    return this->ingress_shards[ingress_id].flits_dropped;
+  };
+  uint64_t get_throttled_cycles(uint64_t ingress_id) {
+    return this->ingress_shards[ingress_id].throttled_cycles;
+  };
+
+  // Flits in the network, sent by their ingress and not yet received.
+  // Copies the oldest, returning false if there are none, or all of them.
+  bool get_oldest_network_flit(flit_t& flit);
+  std::vector<flit_t> get_network_flits();
+  // Flits awaiting injection at an ingress
+  uint64_t get_queued_flits(uint64_t ingress_id);
+
+  // Saves the state of the traffic at the end of a cycle: the generators,
+  // ingress queues and inflight flits, but not the statistics. Restoring
+  // it into a model built from a compatible config resumes the traffic,
+  // with the random streams keyed by the restoring config's seed. Must not
+  // race with the ticks.
+  virtual void save(checkpoint_writer_t& ckpt);
+  virtual void restore(checkpoint_reader_t& ckpt);
 
 protected:
-  uint64_t inject_flits_for_packet(uint64_t ingress_id, uint64_t egress_id,
-				   bool count_injected_flits,
-				   uint64_t current_cycle);
-  void eject_flits(bool head, bool tail,
-		   uint64_t ingress_id, uint64_t egress_id, uint64_t unique_id,
-		   uint64_t current_cycle, bool count_recvd_flits);
+  // Packet awaiting injection. Its flits are only written to the arena
+  // as they are sent, so a queued packet costs one descriptor.
+  typedef struct queued_packet_t {
+    uint64_t egress_id;
+    uint64_t num_flits;
+    uint64_t creation_cycle;
+    uint64_t tag;
+    uint64_t traffic_class;
+  } queued_packet_t;
 
-  uint64_t get_median(std::map<uint64_t,uint64_t> &hist, uint64_t total) {
-    uint64_t running = 0;
-    for (std::map<uint64_t,uint64_t>::iterator it = hist.begin(); it != hist.end(); ++it) {
-      running += it->second;
-      if (running >= total / 2) {
-	return it->first;
-      }
+  // State owned by one ingress
+  typedef struct alignas(64) ingress_shard_t {
+    // Flits generated by this ingress, until they are received
+    flit_arena_t flits;
+    // Packets awaiting injection, and the flits of the front packet
+    // already sent
+    ring_queue_t<queued_packet_t> queue;
+    uint64_t front_flits_sent;
+    // Count flits sent, by egress, and by traffic class
+    std::vector<uint64_t> flits_sent;
+    std::vector<uint64_t> flits_sent_by_class;
+    // Flits offered, including those dropped at a full source queue
+    uint64_t window_flits_sent;
+    // Count flits dropped and cycles throttled at a full source queue
+    uint64_t flits_dropped;
+    uint64_t throttled_cycles;
+    // Flits generated, flushed and sent into the network, read by
+    // count_inflight_flits and the telemetry
+    std::atomic<uint64_t> num_generated;
+    std::atomic<uint64_t> num_flushed;
+    std::atomic<uint64_t> num_injected;
+    // Departure cycle of the head of the packet being sent
+    uint64_t head_departure_cycle;
+  } ingress_shard_t;
+
+  // State owned by one egress
+  typedef struct alignas(64) egress_shard_t {
+    // Count flits received and their latencies, by ingress
+    std::vector<uint64_t> flits_received;
+    std::vector<latency_hist_t<uint32_t>> latencies_by_ingress;
+    latency_hist_t<uint64_t> latencies;
+    // Packet latencies by ingress, with packet_stats
+    std::vector<packet_latencies_t<uint32_t>> packet_latencies_by_ingress;
+    packet_latencies_t<uint64_t> packet_latencies;
+    // Count flits received, their latencies and with packet_stats their
+    // packets' latencies, by traffic class
+    std::vector<uint64_t> flits_received_by_class;
+    std::vector<latency_hist_t<uint32_t>> latencies_by_class;
+    std::vector<packet_latencies_t<uint32_t>> packet_latencies_by_class;
+    uint64_t window_flits_received;
+    latency_hist_t<uint64_t> window_latencies;
+    // Latencies of every flit received since the last telemetry window
+    latency_hist_t<uint64_t> telemetry_latencies;
+    // Flits received, read by count_inflight_flits and the telemetry
+    std::atomic<uint64_t> num_received;
+  } egress_shard_t;
+
+  // Queues a packet for injection, or drops it if the source queue is full
+  void inject_flits_for_packet(uint64_t ingress_id, uint64_t egress_id,
+			       uint64_t num_flits,
+			       bool count_injected_flits,
+			       uint64_t current_cycle,
+			       uint64_t tag = 0,
+			       uint64_t traffic_class = 0);
+  // Whether the generators of the ingress must hold back their packets,
+  // counting the throttled cycle
+  bool throttle_source(uint64_t ingress_id, bool count_throttled_cycles) {
+    ingress_shard_t& shard = this->ingress_shards[ingress_id];
+    if (!this->source_queue_throttle || shard.queue.size() < this->source_queue_limit) {
+      return false;
     }
-    return 0;
+    shard.throttled_cycles += count_throttled_cycles;
+    return true;
   }
+  flit_t* dequeue_flit(uint64_t ingress_id, bool ready, uint64_t current_cycle);
+  // Maps packet tags to and from their form in checkpoints
+  virtual uint64_t save_tag(uint64_t tag) { return tag; }
+  virtual uint64_t restore_tag(uint64_t tag) { return tag; }
+  // Saves the position of a generator in its random stream
+  static void save_injection(checkpoint_writer_t& ckpt, const injection_state_t& state);
+  static void restore_injection(checkpoint_reader_t& ckpt, injection_state_t& state);
+  void eject_flits(bool head, bool tail,
+		   uint64_t ingress_id, uint64_t egress_id, uint64_t unique_id,
+		   uint64_t current_cycle, bool count_recvd_flits);
 
   // Flits per packet
   uint64_t flits_per_packet;
-
-  // Counter generating unique flit identifiers
-  uint64_t unique_flit_id;
-  // Ingress queues
-  std::vector<std::queue<flit_t*>> ingress_queues;
-  // Map tracking all inflight flits
-  std::map<uint64_t, flit_t*> inflight_flits;
+  // Seed of every flow's random stream
+  uint64_t seed;
+  // Source queue limit in packets, 0 if unbounded
+  uint64_t source_queue_limit;
+  bool source_queue_throttle;
 
   uint64_t num_ingresses;
   uint64_t num_egresses;
+  // Traffic classes, whose statistics are kept if there is more than one
+  uint64_t num_classes;
+
+  std::vector<ingress_shard_t> ingress_shards;
+  std::vector<egress_shard_t> egress_shards;
+  // Written by count_inflight_flits, and read by the ticks of the next
+  // cycle
+  std::atomic<uint64_t> inflight_flits;
+  // Merged shard latencies, rebuilt when read
+  latency_hist_t<uint64_t> latencies;
+  latency_hist_t<uint64_t> window_latencies;
+  latency_hist_t<uint64_t> telemetry_latencies;
+  bool telemetry_enabled;
+  packet_latencies_t<uint64_t> packet_latencies;
+  latency_hist_t<uint64_t> class_latencies;
+  packet_latencies_t<uint64_t> class_packet_latencies;
+  bool packet_stats;
+
+  // Unique ids hold the ingress id above the sequence number in its arena
+  uint64_t get_new_unique_flit_id(uint64_t ingress_id) {
+    return (ingress_id << flit_arena_t::SEQ_BITS) | this->ingress_shards[ingress_id].flits.next_seq();
+  }
 
-  // Count flits sent per flow
-  std::vector<std::vector<uint64_t>> flits_sent;
-  // Count flits received per flow
-  std::vector<std::vector<uint64_t>> flits_received;
-  uint64_t total_flits_received;
-  // latency histogram
-  std::vector<std::vector<std::map<uint64_t, uint64_t>>> latencies_by_flow;
-  std::map<uint64_t,uint64_t> latencies;
+  // Samples the number of idle cycles before the next packet of a flow
+  // which injects a packet each cycle with probability p, given log(1-p)
+  uint64_t sample_gap(injection_state_t& state, double log_1mp);
+  static double log_1mp_of(double p) {
+    return p >= 1.0 ? -std::numeric_limits<double>::infinity() : std::log1p(-p);
+  }
+  // Samples Pareto(alpha) with the given minimum value
+  double sample_pareto(injection_state_t& state, double scale, double alpha) {
+    return scale / std::pow(1.0 - state.rng.uniform(), 1.0 / alpha);
+  }
 
-  uint64_t get_new_unique_flit_id() { return unique_flit_id++; }
+  // Injection processes. rate is in flits/cycle. Each flow of an ingress
+  // has a distinct flow_id, keying its random stream.
+  void init_injection(injection_state_t& state, uint64_t ingress_id, uint64_t flow_id,
+		      uint64_t egress_id, float rate,
+		      const injection_process_t& process, const packet_size_t& size);
+  // Returns the cycle of the first packet, or UINT64_MAX if there is none
+  uint64_t first_arrival(injection_state_t& state, uint64_t current_cycle);
+  // Given a packet of num_flits at arrival_cycle, returns the next's cycle
+  uint64_t next_arrival(injection_state_t& state, uint64_t arrival_cycle, uint64_t num_flits);
+  uint64_t sample_packet_size(injection_state_t& state);
+  uint64_t sample_burst(injection_state_t& state);
+  uint64_t sample_off(injection_state_t& state);
 };
 
 
@@ -188,6 +1106,63 @@ class random_traffic_eval_t : public traffic_eval_t
 public:
   random_traffic_eval_t(runtime_params_t *params);
 
+  void set_load_scale(float scale);
+  uint64_t next_event_cycle(uint64_t current_cycle);
+  flit_t* ingress_tick(uint64_t ingress_id, uint64_t current_cycle,
+		       char ready,
+		       bool gen_packets,
+		       bool count_sent_flits);
+  void egress_tick(uint64_t egress_id,
+		   bool* ready, bool valid, bool head, bool tail,
+		   uint64_t ingress_id, uint64_t unique_id,
+		   uint64_t current_cycle, bool count_recvd_flits
+		   );
+  void save(checkpoint_writer_t& ckpt);
+  void restore(checkpoint_reader_t& ckpt);
+protected:
+  // Generates the packets of the ingress's flows due by current_cycle
+  void generate_packets(uint64_t ingress_id, uint64_t current_cycle, bool count_sent_flits);
+  // Queues a generated packet for injection
+  virtual void enqueue_packet(uint64_t ingress_id, uint64_t egress_id, uint64_t num_flits,
+			      bool count_sent_flits, uint64_t current_cycle, uint64_t traffic_class) {
+    inject_flits_for_packet(ingress_id, egress_id, num_flits, count_sent_flits, current_cycle,
+			    0, traffic_class);
+  }
+  // Whether the flows of the ingress must hold back their packets
+  virtual bool hold_packets(uint64_t ingress_id, bool count_sent_flits) {
+    return throttle_source(ingress_id, count_sent_flits);
+  }
+
+  runtime_params_t* params;
+  // Set if hold_packets can hold back the flows, which then resume their
+  // processes from the cycle their packet is accepted
+  bool flows_held;
+  // Generator state of each flow, by ingress id
+  std::vector<std::vector<injection_state_t>> flows_by_ingress;
+  // Per-ingress min-heap of (next packet cycle, index into flows_by_ingress)
+  typedef std::pair<uint64_t, uint64_t> arrival_t;
+  std::vector<std::priority_queue<arrival_t, std::vector<arrival_t>, std::greater<arrival_t>>> arrivals;
+  // Bytes rather than std::vector<bool>, whose packed bits cannot be
+  // written by concurrent ingresses
+  std::vector<char> arrivals_started;
+};
+
+
+// Closed-loop request/response traffic over the explicit flows, modeling
+// requesters with a limited number of outstanding transactions, such as
+// MSHRs. Ingress i and egress i form endpoint i. The flows generate
+// requests, which wait in a backlog at their endpoint until one of its
+// request_window transaction slots is free, and stall while request_window
+// requests are backlogged. The egress receiving the tail of a request
+// schedules a reply_flits reply from its endpoint's ingress after
+// service_latency cycles. The reply's tail frees the requester's slot,
+// completing the transaction.
+class request_response_traffic_eval_t : public random_traffic_eval_t
+{
+public:
+  request_response_traffic_eval_t(runtime_params_t *params);
+
+  uint64_t next_event_cycle(uint64_t current_cycle);
   flit_t* ingress_tick(uint64_t ingress_id, uint64_t current_cycle,
 		       char ready,
 		       bool gen_packets,
@@ -197,14 +1172,373 @@ public:
 		   uint64_t ingress_id, uint64_t unique_id,
 		   uint64_t current_cycle, bool count_recvd_flits
 		   );
+  // Adds the pending replies to the inflight flits
+  void count_inflight_flits();
+  // Drops the backlogged requests. Issued transactions still complete.
+  void flush_ingress_queues();
+  void reset_stats();
+  void save(checkpoint_writer_t& ckpt);
+  void restore(checkpoint_reader_t& ckpt);
+
+  void print_results(std::ostream& os);
+  void print_json(std::ostream& os);
+
 private:
-  // Utilities for random generation
-  std::default_random_engine generator;
-  std::uniform_real_distribution<float> egress_selector;
-  // Track flows by ingress id
-  std::vector<std::vector<flow_rate_t>> flows_by_ingress;
+  typedef struct request_t {
+    uint64_t egress_id;
+    uint64_t num_flits;
+    uint64_t traffic_class;
+  } request_t;
+
+  typedef struct reply_t {
+    uint64_t ready_cycle;
+    uint64_t requester;
+    uint64_t transaction;
+  } reply_t;
+
+  // Requester state of one endpoint
+  typedef struct alignas(64) endpoint_t {
+    // Owned by the ingress. Requests awaiting a transaction slot, the
+    // free slots, and the reply flits sent in measurement.
+    ring_queue_t<request_t> backlog;
+    std::vector<uint32_t> free_slots;
+    uint64_t reply_flits_sent;
+    // Shared by the ingress and egress, and by the egresses serving this
+    // endpoint's requests, under lock
+    std::mutex lock;
+    // Replies awaiting injection from this endpoint, in ready_cycle order
+    ring_queue_t<reply_t> replies;
+    // Slots of transactions completed by the egress, and issue cycle of
+    // each slot's transaction
+    std::vector<uint32_t> completed_slots;
+    std::vector<uint64_t> issue_cycles;
+    // Owned by the egress. Transactions completed and their round-trip
+    // latencies, from issue to reply, and the reply flits received and
+    // their latencies, in measurement.
+    uint64_t transactions;
+    latency_hist_t<uint64_t> round_trips;
+    uint64_t reply_flits_received;
+    latency_hist_t<uint64_t> reply_latencies;
+  } endpoint_t;
+
+  void enqueue_packet(uint64_t ingress_id, uint64_t egress_id, uint64_t num_flits,
+		      bool, uint64_t, uint64_t traffic_class);
+  bool hold_packets(uint64_t ingress_id, bool);
+
+  // Packets are tagged with the requester's transaction slot, and this
+  // bit on replies. Replies are kept out of the flow and class statistics,
+  // which cover the requests, and reported with the transactions.
+  static const uint64_t REPLY_TAG = (uint64_t)1 << 32;
+
+  uint64_t window;
+  uint64_t reply_flits;
+  uint64_t service_latency;
+  std::vector<endpoint_t> endpoints;
+  // Cycles measured since the last reset_stats, across sweep points or
+  // adaptive batches, counted by egress 0
+  uint64_t measured_cycles;
+  uint64_t last_measured_cycle;
+  bool measuring;
+};
+
+
+// Synthetic traffic following a built-in pattern. Each ingress injects
+// packets at the pattern rate, choosing each packet's egress as a function
+// of its ingress id (and for the random patterns, a random draw).
+class pattern_traffic_eval_t : public traffic_eval_t
+{
+public:
+  pattern_traffic_eval_t(runtime_params_t *params);
+
+  void set_load_scale(float scale);
+  uint64_t next_event_cycle(uint64_t current_cycle);
+  flit_t* ingress_tick(uint64_t ingress_id, uint64_t current_cycle,
+		       char ready,
+		       bool gen_packets,
+		       bool count_sent_flits);
+  void egress_tick(uint64_t egress_id,
+		   bool* ready, bool valid, bool head, bool tail,
+		   uint64_t ingress_id, uint64_t unique_id,
+		   uint64_t current_cycle, bool count_recvd_flits
+		   );
+  void save(checkpoint_writer_t& ckpt);
+  void restore(checkpoint_reader_t& ckpt);
+private:
+  enum pattern_t {
+    UNIFORM,
+    TRANSPOSE,
+    BITCOMP,
+    BITREV,
+    SHUFFLE,
+    TORNADO,
+    NEIGHBOR,
+    HOTSPOT
+  };
+
+  uint64_t get_egress(uint64_t ingress_id);
+  uint64_t get_uniform_egress(uint64_t ingress_id) {
+    return std::min((uint64_t)(this->injections[ingress_id].rng.uniform() * this->num_egresses),
+		    this->num_egresses - 1);
+  }
+
+  runtime_params_t* params;
+  pattern_t pattern;
+  // Generator state and next packet cycle of each ingress. Next packet
+  // cycle is 0 before the ingress first generates packets.
+  std::vector<injection_state_t> injections;
+  std::vector<uint64_t> next_arrivals;
+  std::vector<char> arrivals_started;
+  // Bits in a node id, for the bit permutations
+  uint64_t bits;
+  // Nodes form a radix-ary, dims-dimensional cube for the coordinate patterns
+  uint64_t radix;
+  uint64_t dims;
+  float hotspot_fraction;
+  std::vector<uint64_t> hotspot_egresses;
+};
+
+
+// Steps the offered load through the sweep range within one run. Each
+// point shifts the measurement window of params to begin after the
+// settling period, so the phase predicates of runtime_params_t apply to
+// the current point.
+class load_sweep_t
+{
+public:
+  load_sweep_t(runtime_params_t *params, traffic_eval_t *eval);
+
+  // Advances the sweep once the current point's window has ended
+  void tick(uint64_t current_cycle);
+  bool done() { return this->finished; };
+  void print_results(std::ostream& os);
+  void print_json(std::ostream& os);
+
+private:
+  // Records the point whose measurement window just ended, and moves to
+  // the next load or finishes
+  void record_point(uint64_t current_cycle);
+  // Flits sent into the network and not yet received
+  int64_t network_flits();
+
+  typedef struct sweep_point_t {
+    float scale;
+    // Offered and accepted load, in flits/cycle/ingress. The network
+    // accepts the flits received over the window, and the growth in
+    // flits sent into it but not yet received.
+    double offered;
+    double accepted;
+    uint64_t median_latency;
+    uint64_t p99_latency;
+    uint64_t max_latency;
+    bool saturated;
+  } sweep_point_t;
+
+  runtime_params_t* params;
+  traffic_eval_t* eval;
+  std::vector<sweep_point_t> points;
+  float scale;
+  bool finished;
+  // Flits in the network when the current point's window opened
+  bool window_open;
+  int64_t window_network_flits;
+};
+
+// Adapts the warmup and measurement phases to the observed traffic, using
+// batch means over fixed-length batches. Warmup ends once MSER truncation
+// of the batch mean latencies places the end of the initial transient in
+// the first half of the batches. Measurement ends once the confidence
+// intervals of the batch throughputs, medians and p99s are narrow enough.
+class adaptive_measurement_t
+{
+public:
+  adaptive_measurement_t(runtime_params_t *params, traffic_eval_t *eval);
+
+  // Records a batch at each batch boundary, and ends phases
+  void tick(uint64_t current_cycle);
+  uint64_t get_next_batch_cycle() { return this->next_batch_cycle; };
+  void print_results(std::ostream& os);
+  void print_json(std::ostream& os);
+
+private:
+  typedef struct batch_t {
+    double throughput;
+    double mean_latency;
+    double median_latency;
+    double p99_latency;
+  } batch_t;
+  typedef struct interval_t {
+    double mean;
+    double half_width;
+  } interval_t;
+
+  bool warmup_done();
+  interval_t get_interval(double batch_t::*metric);
+  bool interval_converged(double batch_t::*metric);
+
+  runtime_params_t* params;
+  traffic_eval_t* eval;
+  std::vector<batch_t> batches;
+  uint64_t max_warmup_cycles;
+  uint64_t max_measurement_cycles;
+  uint64_t next_batch_cycle;
+  bool measuring;
+  bool finished;
+  // Standard normal quantile for the confidence level
+  double z;
+};
+
+// One window of telemetry. Binary telemetry files hold a
+// telemetry_header_t followed by these records.
+#define TELEMETRY_MAGIC   0x4d544e43 // "CNTM"
+#define TELEMETRY_VERSION 1
+
+typedef struct telemetry_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t window_cycles;
+} telemetry_header_t;
+
+typedef struct telemetry_record_t {
+  uint64_t start_cycle;
+  // Flits generated, sent into the network and received in the window
+  uint64_t generated;
+  uint64_t injected;
+  uint64_t received;
+  // Flits inflight and waiting in ingress queues at the end of the window
+  uint64_t inflight;
+  uint64_t queued;
+  // Latencies of the flits received in the window
+  uint64_t median_latency;
+  uint64_t p99_latency;
+  uint64_t max_latency;
+} telemetry_record_t;
+
+static_assert(sizeof(telemetry_header_t) == 16, "telemetry_header_t layout");
+static_assert(sizeof(telemetry_record_t) == 72, "telemetry_record_t layout");
+
+// Records traffic counters over fixed windows of cycles. Records are
+// pushed onto a preallocated ring at the end of each window, and a
+// background thread writes them to the telemetry file, so the simulation
+// does not wait on file output.
+class telemetry_t
+{
+public:
+  telemetry_t(runtime_params_t *params, traffic_eval_t *eval);
+
+  // Records the windows which have ended by the end of current_cycle
+  void tick(uint64_t current_cycle);
+  // Last cycle of the current window, which must be ticked to record it
+  uint64_t get_window_end_cycle() { return this->next_window_cycle - 1; };
+  // Records the final partial window, and waits for the writer to finish
+  void finish(uint64_t current_cycle);
+
+private:
+  void record_window(uint64_t end_cycle);
+  // Writer thread body, draining ring into file
+  void write_records();
+
+  runtime_params_t* params;
+  traffic_eval_t* eval;
+  FILE* file;
+  spsc_ring_t<telemetry_record_t> ring;
+  std::thread writer;
+  std::atomic<bool> finished;
+  uint64_t window_start_cycle;
+  uint64_t next_window_cycle;
+  // Cumulative counts at the start of the window
+  uint64_t last_generated;
+  uint64_t last_injected;
+  uint64_t last_received;
+};
+
+// Aborts runs which stop making progress, in any phase, rather than
+// waiting for the drain timeout. Checks run every watchdog_cycles / 16
+// cycles, so a stall is detected within 1/16 of the threshold.
+class watchdog_t
+{
+public:
+  watchdog_t(runtime_params_t *params, traffic_eval_t *eval);
+
+  // Returns true once the run has stalled
+  bool tick(uint64_t current_cycle);
+  // Prints the stall, the oldest flit of each ingress and egress pair in
+  // the network, and the ingress queue depths
+  void print_diagnostics(std::ostream& os, uint64_t current_cycle);
+  const std::string& get_reason() { return this->reason; };
+
+private:
+  runtime_params_t* params;
+  traffic_eval_t* eval;
+  uint64_t check_cycles;
+  uint64_t next_check_cycle;
+  // Flits received at the last check, and the last check they changed
+  uint64_t last_received;
+  uint64_t last_progress_cycle;
+  std::string reason;
 };
 
+// Per-link counters of the routers, accumulated each cycle in flat arrays
+// and written as a heatmap every window. The layout names each link as
+// "<src> <dst> <vcs>", by router id, i<ingress> or e<egress>, as in the
+// <nocName>.noc.adjlist. The input ports of the routers come first,
+// followed by their egress ports, which have no stall or occupancy
+// counters. Each window, the links whose counters changed are written as
+// cumulative counts:
+//
+//  nocsample    <cycle> <src> <dst> <flits>
+//  nocstall     <cycle> <src> <dst> <va_stalls> <sa_stalls>
+//  nococcupancy <cycle> <src> <dst> <vc> <flit_cycles>
+//
+// The nocsample records match those printed by the routers under the
+// noc_util_sample_rate plusarg, which scripts/vis.py --animate reads.
+class router_stats_t
+{
+public:
+  router_stats_t(runtime_params_t *params, const std::string& layout);
+
+  uint64_t num_links() { return this->links.size(); };
+  uint64_t num_inputs() { return this->inputs; };
+  uint64_t num_vcs() { return this->occupancy.size(); };
+  // Counters of the current cycle, by link, by input port, and by virtual
+  // channel of the input ports, in layout order
+  void add_flits(uint64_t link, uint64_t flits) { this->flits[link] += flits; };
+  void add_stalls(uint64_t input, uint64_t va_stalls, uint64_t sa_stalls) {
+    this->va_stalls[input] += va_stalls;
+    this->sa_stalls[input] += sa_stalls;
+  };
+  void add_occupancy(uint64_t vc, uint64_t flits) { this->occupancy[vc] += flits; };
+  // Writes the windows which have ended by the end of current_cycle
+  void tick(uint64_t current_cycle);
+  // Writes the final partial window and closes the file
+  void finish(uint64_t current_cycle);
+  // Held while accumulating a cycle, as router_stats_tick may run
+  // concurrently with the finish from check_eval_done
+  std::mutex lock;
+
+private:
+  typedef struct link_t {
+    std::string src;
+    std::string dst;
+    uint64_t first_vc;
+    uint64_t num_vcs;
+  } link_t;
+
+  void write_window(uint64_t end_cycle);
+
+  runtime_params_t* params;
+  FILE* file;
+  std::vector<link_t> links;
+  uint64_t inputs;
+  uint64_t next_window_cycle;
+  // Cumulative counters, and their values at the last window written
+  std::vector<uint64_t> flits;
+  std::vector<uint64_t> va_stalls;
+  std::vector<uint64_t> sa_stalls;
+  std::vector<uint64_t> occupancy;
+  std::vector<uint64_t> last_flits;
+  std::vector<uint64_t> last_stalls;
+  std::vector<uint64_t> last_occupancy;
+};
 
 class netrace_traffic_eval_t : public traffic_eval_t
 {
@@ -220,17 +1554,98 @@ public:
 		   uint64_t ingress_id, uint64_t unique_id,
 		   uint64_t current_cycle, bool count_recvd_flits
 		   );
+  void save(checkpoint_writer_t& ckpt);
+  void restore(checkpoint_reader_t& ckpt);
+  void finish();
 private:
+  // Returns the next trace packet, or NULL at the end of the trace
+  nt_packet_t* read_trace_packet();
+  // Decodes the next packet from the trace file
+  nt_packet_t* decode_trace_packet();
+  // Producer thread body, decoding the trace into prefetch_ring
+  void prefetch_trace();
+  bool dependencies_cleared(nt_packet_t* packet);
+  // Queues a packet whose dependencies have cleared for injection. Packets
+  // outside the network finish immediately, releasing their children.
+  void release_packet(nt_packet_t* packet);
+  // Finishes a packet, releasing the children it was the last parent of
+  void clear_dependencies_free_packet(nt_packet_t* packet);
+  bool outside_network(nt_packet_t* packet) {
+    return packet->src >= this->num_ingresses || packet->dst >= this->num_egresses;
+  }
+  void free_trace_packet(nt_packet_t* packet);
+  // Checkpoints hold each live trace packet once, and tag flits with
+  // its index
+  uint64_t save_tag(uint64_t tag);
+  uint64_t restore_tag(uint64_t tag);
+  void save_trace_packet(checkpoint_writer_t& ckpt, nt_packet_t* packet);
+  nt_packet_t* restore_trace_packet(checkpoint_reader_t& ckpt);
 
-  std::vector<std::list<std::pair<nt_packet_t*, uint64_t>>> waiting_queues;
-  std::map<uint64_t, nt_packet_t*> nt_packet_map;
-  std::list<nt_packet_t*> dead_packets;
+  // Dependencies span terminals, so the trace state below is shared by
+  // all terminals and guarded by trace_lock
+  std::mutex trace_lock;
+  // Packets with cleared dependencies awaiting injection, by ingress
+  std::vector<ring_queue_t<nt_packet_t*>> ready_queues;
+  // Packets waiting on unfinished parents, by id
+  std::unordered_map<uint32_t, nt_packet_t*> blocked_packets;
   nt_context_t nt_ctx;
   nt_header_t* nt_header;
+  // Memory-mapped binary trace, or NULL when replaying a netrace file
+  trace_binary_t* binary_trace;
+  // Index in binary_trace of the first packet of the replayed region,
+  // and of the next packet
+  uint64_t binary_first_packet;
+  uint64_t binary_next_packet;
   bool ignore_dependencies;
+  // Decoded packets from the prefetch thread, or NULL without prefetching
+  spsc_ring_t<nt_packet_t*>* prefetch_ring;
+  std::thread prefetch_thread;
+  // Set by finish to stop the prefetch thread
+  std::atomic<bool> prefetch_stop;
+  // Set under prefetch_lock once the prefetch thread pushes no more, and
+  // signalled with each push, for read_trace_packet to wait on
+  bool prefetch_done;
+  std::mutex prefetch_lock;
+  std::condition_variable prefetch_pushed;
+  // Number of unfinished parents of each packet id, tracked here rather
+  // than by netrace so the trace can be decoded on another thread
+  std::unordered_map<uint32_t, uint32_t> dependency_refs;
   nt_packet_t* trace_packet;
+  // Packets being finished by clear_dependencies_free_packet, each with
+  // the index of its next dependency to clear
+  std::vector<std::pair<nt_packet_t*, uint64_t>> finishing_packets;
+  // Packets returned by read_trace_packet, including trace_packet
+  uint64_t trace_packets_read;
   uint64_t cycle_offset;
   uint64_t next_cycle;
+  // Index of each packet in the checkpoint being saved, and the packets
+  // of the checkpoint being restored
+  std::unordered_map<nt_packet_t*, uint64_t> checkpoint_indices;
+  std::vector<nt_packet_t*> checkpoint_packets;
 };
 
+// Global evaluation state and per-cycle entry points shared by the DPI
+// functions and by host drivers built with NO_VPI, such as noc_model
+extern runtime_params_t* params;
+extern traffic_eval_t* eval;
+extern router_stats_t* router_stats;
+
+void init_params(std::string config_str);
+void init_eval();
+void check_eval_done(uint64_t current_cycle, unsigned char* success, unsigned char* fatal);
+uint64_t get_next_tick_cycle(uint64_t current_cycle);
+// Creates router_stats for the network described by layout, if the
+// router_stats directive is set. Called once, by the first tick of the
+// network's counters.
+void init_router_stats(const std::string& layout);
+// Saves the traffic state at the end of current_cycle, or restores it,
+// returning the cycle of the checkpoint. Called between cycles, by the
+// batched traffic_tick or a host driver, and by init_eval, under the
+// checkpoint_save and checkpoint_restore directives.
+void save_checkpoint(const std::string& path, uint64_t current_cycle);
+uint64_t restore_checkpoint(const std::string& path);
+// Whether the checkpoint_save directive is due at the end of
+// current_cycle, after the cycle's flits have been exchanged. True once.
+bool checkpoint_save_due(uint64_t current_cycle);
+
 #endif
@@ -0,0 +1,254 @@
+/*
+ * Microbenchmark of the traffic models of TrafficEval.cpp, isolated from
+ * any simulator. Each traffic model drives a loopback network which
+ * delivers every flit to its egress after a fixed latency, with each
+ * egress accepting one flit per cycle.
+ *
+ * Each configuration runs in its own forked process, with fresh global
+ * state, and reports one CSV row of the time per ingress_tick and
+ * egress_tick call, C++ heap allocations per ejected flit, and the peak
+ * RSS of the process. Times and allocations are measured after warmup.
+ *
+ * Usage: traffic_bench [options]
+ *   --terminals N,...  terminal counts of the synthetic models (16,64,256,1024)
+ *   --rates R,...      injection rates, in flits/cycle per ingress (0.05,0.2,0.5)
+ *   --latency N        cycles from ingress to egress (20)
+ *   --warmup N         cycles before measurement (2000)
+ *   --cycles N         measured cycles (10000)
+ *   --netrace TRACE    also replay TRACE, at its own terminal count
+ */
+
+#include "TrafficEval.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <new>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (!p) { throw std::bad_alloc(); }
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+typedef struct bench_case_t {
+  std::string model;
+  uint64_t terminals;
+  float rate;
+} bench_case_t;
+
+typedef struct loopback_flit_t {
+  uint64_t arrival_cycle;
+  bool head;
+  bool tail;
+  uint64_t ingress_id;
+  uint64_t unique_id;
+} loopback_flit_t;
+
+static uint64_t latency = 20;
+static uint64_t warmup = 2000;
+static uint64_t cycles = 10000;
+static std::string netrace_trace;
+
+static std::string make_config(const bench_case_t& c) {
+  std::ostringstream config;
+  // The run never leaves measurement, so the results are never reported
+  config << "warmup " << warmup << "\n"
+	 << "measurement " << cycles * 2 << "\n"
+	 << "num_ingresses " << c.terminals << "\n"
+	 << "num_egresses " << c.terminals << "\n";
+  if (c.model == "netrace") {
+    config << "netrace_enable true\n"
+	   << "netrace_trace " << netrace_trace << "\n"
+	   << "netrace_region 0\n";
+  } else if (c.model == "pattern") {
+    config << "pattern uniform " << c.rate << "\n";
+  } else {
+    // Each ingress sends to four egresses spread across the network
+    for (uint64_t i = 0; i < c.terminals; i++) {
+      for (uint64_t k = 0; k < 4; k++) {
+	uint64_t e = (i + 1 + k * c.terminals / 4) % c.terminals;
+	config << "flow " << i << " " << e << " " << c.rate / 4 << "\n";
+      }
+    }
+  }
+  return config.str();
+}
+
+static void run_case(const bench_case_t& c) {
+  // Silence the model's own logging. Without a buffer, std::cout drops
+  // its output without formatting it
+  std::streambuf* cout_buf = std::cout.rdbuf(NULL);
+  init_params(make_config(c));
+  init_eval();
+
+  std::vector<ring_queue_t<loopback_flit_t>> network(c.terminals);
+  std::vector<char> egress_ready(c.terminals, 1);
+  std::chrono::steady_clock::duration ingress_time(0);
+  std::chrono::steady_clock::duration egress_time(0);
+  uint64_t start_allocations = 0;
+  uint64_t flits = 0;
+
+  for (uint64_t cycle = 0; cycle < warmup + cycles; cycle++) {
+    bool measured = cycle >= warmup;
+    if (cycle == warmup) {
+      start_allocations = allocations.load(std::memory_order_relaxed);
+    }
+    bool in_measurement = params->in_measurement(cycle);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < c.terminals; i++) {
+      flit_t* flit = eval->ingress_tick(i, cycle, true, true, in_measurement);
+      if (flit) {
+	network[flit->egress_id].push({cycle + latency, flit->head, flit->tail, i, flit->unique_id});
+      }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint64_t e = 0; e < c.terminals; e++) {
+      ring_queue_t<loopback_flit_t>& q = network[e];
+      bool valid = egress_ready[e] && !q.empty() && q.front().arrival_cycle <= cycle;
+      loopback_flit_t flit = valid ? q.front() : loopback_flit_t();
+      if (valid) {
+	q.pop();
+	flits += measured;
+      }
+      bool ready;
+      eval->egress_tick(e, &ready, valid, flit.head, flit.tail, flit.ingress_id, flit.unique_id,
+			cycle, in_measurement);
+      egress_ready[e] = ready;
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    if (measured) {
+      ingress_time += t1 - t0;
+      egress_time += t2 - t1;
+    }
+  }
+  uint64_t measured_allocations = allocations.load(std::memory_order_relaxed) - start_allocations;
+  std::cout.rdbuf(cout_buf);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double ticks = (double)cycles * c.terminals;
+  double ingress_ns = std::chrono::duration<double, std::nano>(ingress_time).count();
+  double egress_ns = std::chrono::duration<double, std::nano>(egress_time).count();
+  char rate[32] = "-";
+  if (c.model != "netrace") {
+    snprintf(rate, sizeof(rate), "%g", c.rate);
+  }
+  printf("%s, %llu, %s, %llu, %.1f, %.1f, %.1f, %llu, %.3f, %ld\n",
+	 c.model.c_str(),
+	 (unsigned long long)c.terminals,
+	 rate,
+	 (unsigned long long)latency,
+	 ingress_ns / ticks,
+	 egress_ns / ticks,
+	 (ingress_ns + egress_ns) / cycles,
+	 (unsigned long long)flits,
+	 flits ? (double)measured_allocations / flits : 0.0,
+	 usage.ru_maxrss);
+  fflush(stdout);
+}
+
+static uint64_t netrace_nodes(const std::string& path) {
+  if (trace_binary_t::is_binary_trace(path)) {
+    trace_binary_t trace;
+    if (!trace.open(path)) { return 0; }
+    return trace.header()->num_nodes;
+  }
+  nt_context_t ctx;
+  memset(&ctx, 0, sizeof(nt_context_t));
+  nt_open_trfile(&ctx, path.c_str());
+  uint64_t nodes = nt_get_trheader(&ctx)->num_nodes;
+  nt_close_trfile(&ctx);
+  return nodes;
+}
+
+template <typename T>
+static std::vector<T> parse_list(const char* arg) {
+  std::vector<T> values;
+  std::istringstream ss(arg);
+  std::string value;
+  while (std::getline(ss, value, ',')) {
+    values.push_back((T)std::stod(value));
+  }
+  return values;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s [--terminals N,...] [--rates R,...] [--latency N] "
+	  "[--warmup N] [--cycles N] [--netrace TRACE]\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  std::vector<uint64_t> terminals = {16, 64, 256, 1024};
+  std::vector<float> rates = {0.05f, 0.2f, 0.5f};
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (i + 1 >= argc) { usage(argv[0]); }
+    const char* value = argv[++i];
+    if (arg == "--terminals") {
+      terminals = parse_list<uint64_t>(value);
+    } else if (arg == "--rates") {
+      rates = parse_list<float>(value);
+    } else if (arg == "--latency") {
+      latency = std::stoull(value);
+    } else if (arg == "--warmup") {
+      warmup = std::stoull(value);
+    } else if (arg == "--cycles") {
+      cycles = std::stoull(value);
+    } else if (arg == "--netrace") {
+      netrace_trace = value;
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (cycles == 0) { usage(argv[0]); }
+
+  std::vector<bench_case_t> cases;
+  for (const char* model : {"flows", "pattern"}) {
+    for (uint64_t n : terminals) {
+      for (float rate : rates) {
+	cases.push_back({model, n, rate});
+      }
+    }
+  }
+  if (!netrace_trace.empty()) {
+    uint64_t nodes = netrace_nodes(netrace_trace);
+    if (nodes == 0) {
+      fprintf(stderr, "Unable to read %s\n", netrace_trace.c_str());
+      return 1;
+    }
+    cases.push_back({"netrace", nodes, 0.0f});
+  }
+
+  printf("model, terminals, rate, latency, ns_per_ingress_tick, ns_per_egress_tick, "
+	 "ns_per_cycle, flits, allocs_per_flit, peak_rss_kb\n");
+  fflush(stdout);
+  bool failed = false;
+  for (const bench_case_t& c : cases) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      run_case(c);
+      _exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s with %llu terminals failed\n", c.model.c_str(), (unsigned long long)c.terminals);
+      failed = true;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -26,6 +26,38 @@ import "DPI-C" function void egress_tick
    output bit 	 success
    );
 
+import "DPI-C" function void traffic_tick
+  (
+   input string   config_str,
+   input longint  current_cycle,
+   input bit 	  flit_out_ready[],
+   output bit 	  flit_out_valid[],
+   output bit 	  flit_out_head[],
+   output bit 	  flit_out_tail[],
+   output longint flit_out_egress_id[],
+   output longint flit_out_unique_id[],
+   output bit 	  flit_in_ready[],
+   input bit 	  flit_in_valid[],
+   input bit 	  flit_in_head[],
+   input bit 	  flit_in_tail[],
+   input longint  flit_in_ingress_id[],
+   input longint  flit_in_unique_id[],
+   output bit 	  success,
+   output bit 	  fatal,
+   output longint next_cycle
+   );
+
+import "DPI-C" function void router_stats_tick
+  (
+   input string  config_str,
+   input string  layout_str,
+   input longint current_cycle,
+   input int 	 link_flits[],
+   input int 	 va_stall[],
+   input int 	 sa_stall[],
+   input int 	 occupancy[]
+   );
+
 
 module TrafficEvalIngress #(parameter INGRESS_ID,
 			    parameter CONFIG_STR) (
@@ -158,3 +190,171 @@ module TrafficEvalEgress #(parameter EGRESS_ID,
    assign __flit_in_ingress_id = flit_in_ingress_id;
    assign __flit_in_unique_id = flit_in_unique_id;
 endmodule
+
+
+
+// Drives every ingress and egress with a single traffic_tick DPI call per
+// cycle. Per-terminal signals are packed, with terminal i at bit i (or
+// bits [64*i+63:64*i] for ids).
+// With FAST_FORWARD set, the cycle count is kept here instead of taken
+// from current_cycle, and jumps over idle cycles to the next cycle the
+// traffic model reports an event at.
+module TrafficEvalBatched #(parameter NUM_INGRESSES,
+			    parameter NUM_EGRESSES,
+			    parameter CONFIG_STR,
+			    parameter FAST_FORWARD = 0) (
+    input 			   clock,
+    input 			   reset,
+    input [63:0] 		   current_cycle,
+    input [NUM_INGRESSES-1:0] 	   flit_out_ready,
+    output [NUM_INGRESSES-1:0] 	   flit_out_valid,
+    output [NUM_INGRESSES-1:0] 	   flit_out_head,
+    output [NUM_INGRESSES-1:0] 	   flit_out_tail,
+    output [64*NUM_INGRESSES-1:0] flit_out_egress_id,
+    output [64*NUM_INGRESSES-1:0] flit_out_unique_id,
+    output [NUM_EGRESSES-1:0] 	   flit_in_ready,
+    input [NUM_EGRESSES-1:0] 	   flit_in_valid,
+    input [NUM_EGRESSES-1:0] 	   flit_in_head,
+    input [NUM_EGRESSES-1:0] 	   flit_in_tail,
+    input [64*NUM_EGRESSES-1:0]   flit_in_ingress_id,
+    input [64*NUM_EGRESSES-1:0]   flit_in_unique_id,
+    output 			   success,
+    output 			   fatal
+    );
+
+   bit 		  __flit_out_ready[NUM_INGRESSES];
+   bit 		  __flit_out_valid[NUM_INGRESSES];
+   bit 		  __flit_out_head[NUM_INGRESSES];
+   bit 		  __flit_out_tail[NUM_INGRESSES];
+   longint 	  __flit_out_egress_id[NUM_INGRESSES];
+   longint 	  __flit_out_unique_id[NUM_INGRESSES];
+
+   bit 		  __flit_in_ready[NUM_EGRESSES];
+   bit 		  __flit_in_valid[NUM_EGRESSES];
+   bit 		  __flit_in_head[NUM_EGRESSES];
+   bit 		  __flit_in_tail[NUM_EGRESSES];
+   longint 	  __flit_in_ingress_id[NUM_EGRESSES];
+   longint 	  __flit_in_unique_id[NUM_EGRESSES];
+   bit 		  __success;
+   bit 		  __fatal;
+   longint 	  __next_cycle;
+
+   reg [63:0] 			  __cycle_reg;
+   reg [NUM_INGRESSES-1:0] 	  __flit_out_valid_reg;
+   reg [NUM_INGRESSES-1:0] 	  __flit_out_head_reg;
+   reg [NUM_INGRESSES-1:0] 	  __flit_out_tail_reg;
+   reg [64*NUM_INGRESSES-1:0] __flit_out_egress_id_reg;
+   reg [64*NUM_INGRESSES-1:0] __flit_out_unique_id_reg;
+   reg [NUM_EGRESSES-1:0] 	  __flit_in_ready_reg;
+   reg 				  __success_reg;
+   reg 				  __fatal_reg;
+
+   always @(posedge clock) begin
+      if (reset) begin
+	 __flit_out_valid_reg <= {NUM_INGRESSES{1'b0}};
+	 __flit_in_ready_reg <= {NUM_EGRESSES{1'b0}};
+	 __success_reg <= 1'b0;
+	 __fatal_reg <= 1'b0;
+	 __cycle_reg <= 64'd0;
+      end else begin
+	 for (int i = 0; i < NUM_INGRESSES; i++) begin
+	    __flit_out_ready[i] = flit_out_ready[i];
+	    __flit_out_valid[i] = 1'b0;
+	 end
+	 for (int i = 0; i < NUM_EGRESSES; i++) begin
+	    __flit_in_valid[i] = flit_in_valid[i];
+	    __flit_in_head[i] = flit_in_head[i];
+	    __flit_in_tail[i] = flit_in_tail[i];
+	    __flit_in_ingress_id[i] = flit_in_ingress_id[64*i +: 64];
+	    __flit_in_unique_id[i] = flit_in_unique_id[64*i +: 64];
+	 end
+	 traffic_tick(CONFIG_STR,
+		      FAST_FORWARD ? __cycle_reg : current_cycle,
+		      __flit_out_ready,
+		      __flit_out_valid,
+		      __flit_out_head,
+		      __flit_out_tail,
+		      __flit_out_egress_id,
+		      __flit_out_unique_id,
+		      __flit_in_ready,
+		      __flit_in_valid,
+		      __flit_in_head,
+		      __flit_in_tail,
+		      __flit_in_ingress_id,
+		      __flit_in_unique_id,
+		      __success,
+		      __fatal,
+		      __next_cycle);
+	 __cycle_reg <= __next_cycle;
+	 for (int i = 0; i < NUM_INGRESSES; i++) begin
+	    __flit_out_valid_reg[i] <= __flit_out_valid[i];
+	    __flit_out_head_reg[i] <= __flit_out_head[i];
+	    __flit_out_tail_reg[i] <= __flit_out_tail[i];
+	    __flit_out_egress_id_reg[64*i +: 64] <= __flit_out_egress_id[i];
+	    __flit_out_unique_id_reg[64*i +: 64] <= __flit_out_unique_id[i];
+	 end
+	 for (int i = 0; i < NUM_EGRESSES; i++) begin
+	    __flit_in_ready_reg[i] <= __flit_in_ready[i];
+	 end
+	 __success_reg <= __success;
+	 __fatal_reg <= __fatal;
+      end // else: !if(reset)
+   end // always @ (posedge clock)
+
+   assign flit_out_valid = __flit_out_valid_reg;
+   assign flit_out_head = __flit_out_head_reg;
+   assign flit_out_tail = __flit_out_tail_reg;
+   assign flit_out_egress_id = __flit_out_egress_id_reg;
+   assign flit_out_unique_id = __flit_out_unique_id_reg;
+   assign flit_in_ready = __flit_in_ready_reg;
+   assign success = __success_reg;
+   assign fatal = __fatal_reg;
+endmodule
+
+
+
+// Reports the routers' counters of each cycle with a single
+// router_stats_tick DPI call. Counters are packed 16 bits each, with
+// entry i at bits [16*i+15:16*i], in the order of the links of
+// LAYOUT_STR.
+module TrafficEvalStats #(parameter NUM_LINKS,
+			  parameter NUM_INPUTS,
+			  parameter NUM_VCS,
+			  parameter CONFIG_STR,
+			  parameter LAYOUT_STR) (
+    input 		      clock,
+    input 		      reset,
+    input [63:0] 	      current_cycle,
+    input [16*NUM_LINKS-1:0]  link_flits,
+    input [16*NUM_INPUTS-1:0] va_stall,
+    input [16*NUM_INPUTS-1:0] sa_stall,
+    input [16*NUM_VCS-1:0]    occupancy
+    );
+
+   int 		  __link_flits[NUM_LINKS];
+   int 		  __va_stall[NUM_INPUTS];
+   int 		  __sa_stall[NUM_INPUTS];
+   int 		  __occupancy[NUM_VCS];
+
+   always @(posedge clock) begin
+      if (!reset) begin
+	 for (int i = 0; i < NUM_LINKS; i++) begin
+	    __link_flits[i] = link_flits[16*i +: 16];
+	 end
+	 for (int i = 0; i < NUM_INPUTS; i++) begin
+	    __va_stall[i] = va_stall[16*i +: 16];
+	    __sa_stall[i] = sa_stall[16*i +: 16];
+	 end
+	 for (int i = 0; i < NUM_VCS; i++) begin
+	    __occupancy[i] = occupancy[16*i +: 16];
+	 end
+	 router_stats_tick(CONFIG_STR,
+			   LAYOUT_STR,
+			   current_cycle,
+			   __link_flits,
+			   __va_stall,
+			   __sa_stall,
+			   __occupancy);
+      end
+   end // always @ (posedge clock)
+endmodule
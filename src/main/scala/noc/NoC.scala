@@ -143,6 +143,10 @@ class NoC(nocParams: NoCParams)(implicit p: Parameters) extends LazyModule {
     val io = IO(new NoCTerminalIO(allIngressParams, allEgressParams)(iP) {
       val router_clocks = Vec(nNodes, Input(new ClockBundle(ClockBundleParameters())))
       val router_ctrl = if (nocParams.hasCtrl) Vec(nNodes, new RouterCtrlBundle) else Nil
+      val router_debug = if (nocParams.hasDebug) {
+        Output(MixedVec(routers.map { r => new DebugBundle(
+          r.allPreDiplomaticInParams.map(_.nVirtualChannels), r.egressNodes.size) }))
+      } else Nil
     })
 
     (io.ingress zip ingressNodes.map(_.out(0)._1)).foreach { case (l,r) => r <> l }
@@ -159,6 +163,10 @@ class NoC(nocParams: NoCParams)(implicit p: Parameters) extends LazyModule {
       }
     }
 
+    if (nocParams.hasDebug) {
+      (io.router_debug zip debugNodes.map(_.in(0)._1)).foreach { case (l,r) => l := r }
+    }
+
     // TODO: These assume a single clock-domain across the entire noc
     val debug_va_stall_ctr = RegInit(0.U(64.W))
     val debug_sa_stall_ctr = RegInit(0.U(64.W))
@@ -199,7 +207,9 @@ class NoC(nocParams: NoCParams)(implicit p: Parameters) extends LazyModule {
 
     val edgeProps = routers.map { r =>
       val outs = r.outParams.map { o =>
-        (Seq(s"${r.nodeId} ${o.destId}") ++ (if (o.possibleFlows.size == 0) Some("unused") else None))
+        val buffers = o.virtualChannelParams.map(_.bufferSize).mkString(",")
+        (Seq(s"${r.nodeId} ${o.destId}") ++ (if (o.possibleFlows.size == 0) Some("unused") else None)
+          ++ Seq(s"buffers=$buffers"))
           .mkString(" ")
       }
       val egresses = r.egressParams.map { e =>
@@ -214,6 +224,29 @@ class NoC(nocParams: NoCParams)(implicit p: Parameters) extends LazyModule {
     }.mkString("\n")
     ElaborationArtefacts.add(prepend("noc.edgeprops"), edgeProps)
 
+    // For each input virtual channel and each flow which may occupy it, the
+    // output virtual channels the routing relation allows. Flows at their
+    // egress node leave through their egress, and are not listed
+    val routingRelation = internalParams.routingRelation
+    val routes = routers.map { r =>
+      val ins = (r.inParams.map { i =>
+        (i.srcId.toString, i.channelRoutingInfos, i.virtualChannelParams.map(_.possibleFlows))
+      } ++ r.ingressParams.map { i =>
+        (s"i${i.ingressId}", i.channelRoutingInfos, Seq(i.possibleFlows))
+      })
+      ins.map { case (src, cIs, vcFlows) =>
+        (cIs zip vcFlows).map { case (cI, flows) =>
+          flows.toSeq.filter(_.egressNode != r.nodeId).sortBy(f => (f.ingressId, f.egressId)).map { f =>
+            val outs = r.outParams.map { o =>
+              o.channelRoutingInfos.filter(oI => routingRelation(cI, oI, f)).map(oI => s"${o.destId}:${oI.vc}")
+            }.flatten
+            (Seq(s"$src ${r.nodeId} ${cI.vc} ${f.ingressId} ${f.egressId}") ++ outs).mkString(" ")
+          }
+        }.flatten
+      }.flatten
+    }.flatten.mkString("\n")
+    ElaborationArtefacts.add(prepend("noc.routes"), routes)
+
     println(s"Constellation: $nocName Finished NoC RTL generation")
   }
 }
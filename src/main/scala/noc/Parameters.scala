@@ -33,6 +33,8 @@ case class NoCParams(
   nocName: String = "test",
   skipValidationChecks: Boolean = false,
   hasCtrl: Boolean = false,
+  // Exports the per-cycle debug counters of each router, in router order
+  hasDebug: Boolean = false,
   inlineNoC: Boolean = false
 )
 // END: NoC Parameters
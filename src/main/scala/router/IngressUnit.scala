@@ -126,6 +126,7 @@ class IngressUnit(
 
   io.debug.va_stall := io.vcalloc_req.valid && !io.vcalloc_req.ready
   io.debug.sa_stall := io.salloc_req(0).valid && !io.salloc_req(0).ready
+  io.debug.occupancy(0) := route_buffer.io.count +& vcalloc_buffer.io.count
 
   // TODO: We should not generate input/ingress/output/egress units for untraversable channels
   if (!cParam.traversable) {
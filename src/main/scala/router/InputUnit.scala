@@ -29,8 +29,10 @@ class AbstractInputUnitIO(
 
   val out = Vec(cParam.destSpeedup, Valid(new SwitchBundle(outParams, egressParams)))
   val debug = Output(new Bundle {
-    val va_stall = UInt(log2Ceil(cParam.nVirtualChannels).W)
-    val sa_stall = UInt(log2Ceil(cParam.nVirtualChannels).W)
+    val va_stall = UInt(log2Ceil(cParam.nVirtualChannels + 1).W)
+    val sa_stall = UInt(log2Ceil(cParam.nVirtualChannels + 1).W)
+    // Flits buffered in each virtual channel
+    val occupancy = Vec(cParam.nVirtualChannels, UInt(16.W))
   })
   val block = Input(Bool())
 }
@@ -184,6 +186,13 @@ class InputUnit(cParam: ChannelParams, outParams: Seq[ChannelParams],
   }
   input_buffer.io.deq.foreach(_.ready := false.B)
 
+  val occupancy = RegInit(VecInit(Seq.fill(nVirtualChannels) { 0.U(16.W) }))
+  occupancy.zipWithIndex.foreach { case (o,i) =>
+    val enq = PopCount(io.in.flit.map(f => f.valid && f.bits.virt_channel_id === i.U))
+    o := o + enq - input_buffer.io.deq(i).fire
+  }
+  io.debug.occupancy := occupancy
+
   val route_arbiter = Module(new Arbiter(
     new RouteComputerReq, nVirtualChannels
   ))
@@ -280,7 +289,7 @@ class InputUnit(cParam: ChannelParams, outParams: Seq[ChannelParams],
     }
   }
 
-  io.debug.va_stall := PopCount(vcalloc_vals) - io.vcalloc_req.ready
+  io.debug.va_stall := PopCount(vcalloc_vals) - io.vcalloc_req.fire
 
   when (io.vcalloc_req.fire) {
     for (i <- 0 until nVirtualChannels) {
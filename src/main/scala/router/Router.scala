@@ -59,9 +59,15 @@ trait HasRouterParams
   def payloadBits = routerParams.user.payloadBits
 }
 
-class DebugBundle(val nIn: Int) extends Bundle {
+class DebugBundle(val inVirtualChannels: Seq[Int], val nEgress: Int) extends Bundle {
+  val nIn = inVirtualChannels.size
   val va_stall = Vec(nIn, UInt())
   val sa_stall = Vec(nIn, UInt())
+  // Flits arriving at each input, buffered in each input virtual channel,
+  // and leaving through each egress, this cycle
+  val in_flits = Vec(nIn, UInt())
+  val occupancy = MixedVec(inVirtualChannels.map { n => Vec(n, UInt(16.W)) })
+  val egress_flits = Vec(nEgress, Bool())
 }
 
 class Router(
@@ -78,7 +84,8 @@ class Router(
   val ingressNodes = preDiplomaticIngressParams.map(u => IngressChannelDestNode(u))
   val egressNodes = egressIds.map(u => EgressChannelSourceNode(u))
 
-  val debugNode = BundleBridgeSource(() => new DebugBundle(allPreDiplomaticInParams.size))
+  val debugNode = BundleBridgeSource(() => new DebugBundle(
+    allPreDiplomaticInParams.map(_.nVirtualChannels), egressIds.size))
   val ctrlNode = if (hasCtrl) Some(BundleBridgeSource(() => new RouterCtrlBundle)) else None
 
   def inParams = module.inParams
@@ -191,6 +198,10 @@ class Router(
 
     (io_debug.va_stall zip all_input_units.map(_.io.debug.va_stall)).map { case (l,r) => l := r }
     (io_debug.sa_stall zip all_input_units.map(_.io.debug.sa_stall)).map { case (l,r) => l := r }
+    (io_debug.occupancy zip all_input_units.map(_.io.debug.occupancy)).map { case (l,r) => l := r }
+    (io_debug.in_flits zip (io_in.map(i => PopCount(i.flit.map(_.valid))) ++ io_ingress.map(_.flit.fire)))
+      .map { case (l,r) => l := r }
+    (io_debug.egress_flits zip io_egress.map(_.flit.fire)).map { case (l,r) => l := r }
 
     val debug_tsc = RegInit(0.U(64.W))
     debug_tsc := debug_tsc + 1.U
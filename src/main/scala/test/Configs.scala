@@ -1049,3 +1049,152 @@ class EvalTestConfig08 extends NoCEvalConfig(NoCEvalParams(
     routingRelation  = ButterflyRouting()
   )
 ))
+
+// 4x4 mesh with a terminal at every router and all-to-all flows, shared
+// by the tests of the traffic model
+class EvalTestMeshConfig(p: NoCEvalParams, nVCs: Int = 1) extends NoCEvalConfig(p.copy(
+  nocParams = NoCParams(
+    topology         = Mesh2D(4, 4),
+    channelParamGen  = (a, b) => UserChannelParams(Seq.fill(nVCs) { UserVirtualChannelParams(4) }),
+    ingresses        = (0 until 16).map { i => UserIngressParams(i) },
+    egresses         = (0 until 16).map { i => UserEgressParams(i) },
+    flows            = Seq.tabulate(16, 16) { (s, d) => FlowParams(s, d, 0) }.flatten,
+    routingRelation  = Mesh2DDimensionOrderedRouting()
+  )
+))
+class EvalTestConfig09 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  flows              = (s, d) => 0.15 / 16,
+  batchedDPI         = true
+))
+class EvalTestConfig10 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  pattern               = "uniform 0.15"
+))
+
+class EvalTestConfig11 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 40,
+  requiredMaxLatency    = 400,
+  requiredThroughput    = 0.95,
+  pattern               = "uniform 0.1",
+  injectionProcess      = "onoff 4",
+  packetSize            = "bimodal 1 8 0.5"
+))
+
+class EvalTestConfig12 extends EvalTestMeshConfig(NoCEvalParams(
+  measurementCycles     = 5000,
+  pattern               = "uniform 0.1",
+  sweep                 = "1.0 8.0 1.0"
+))
+
+class EvalTestConfig13 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  warmupCycles          = 20000,
+  measurementCycles     = 200000,
+  pattern               = "uniform 0.15",
+  adaptive              = "500 0.05"
+))
+class EvalTestConfig14 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  measurementCycles     = 100000,
+  pattern               = "uniform 0.002",
+  batchedDPI            = true,
+  fastForward           = true
+))
+// Outputs of EvalTestConfig15, which NoCTestEval15 reads back
+object EvalTestOutputs {
+  val telemetry = new java.io.File("test_run_dir", "eval_outputs_telemetry.csv").getAbsolutePath
+  val results = new java.io.File("test_run_dir", "eval_outputs_results.json").getAbsolutePath
+}
+class EvalTestConfig15(seed: Long = 12345) extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  pattern               = "uniform 0.15",
+  seed                  = seed,
+  telemetry             = s"1000 ${EvalTestOutputs.telemetry}",
+  resultsFile           = EvalTestOutputs.results,
+  packetStats           = true
+))
+class EvalTestConfig19 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  flitsPerPacket     = 1,
+  flows              = (s, d) => 0.05 / 16,
+  requestResponse    = "4 4 10"
+))
+class EvalTestConfig20 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 100,
+  requiredMaxLatency    = 400,
+  requiredThroughput    = 0.95,
+  pattern               = "uniform 0.6",
+  sourceQueue           = "4 drop"
+))
+class EvalTestConfig21 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  flows              = (s, d) => 0.15 / 16,
+  watchdogCycles        = 5000
+))
+// Checkpoint shared by EvalTestConfig22 and EvalTestConfig26, whose
+// simulations run in separate directories under test_run_dir
+object EvalTestCheckpoint {
+  val path = new java.io.File("test_run_dir", "eval_round_trip.ckpt").getAbsolutePath
+}
+// Saves a checkpoint at the first cycle from 2000 with an empty network
+class EvalTestConfig22 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  pattern               = "uniform 0.02",
+  batchedDPI            = true,
+  checkpointSave        = s"2000 ${EvalTestCheckpoint.path} idle"
+))
+class EvalTestConfig23 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  requiredThroughput    = 0.95,
+  pattern               = "hotspot 0.1 0.5 5 10",
+  routerStats           = "1000 router_stats.log"
+), nVCs = 2)
+class EvalTestConfig24 extends NoCEvalConfig(NoCEvalParams(
+  requiredMedianLatency = 50,
+  requiredMaxLatency    = 1000,
+  requiredThroughput    = 0.95,
+  flows                 = (s, d) => if (s < 16) 0.05 / 16 else 0.2 / 16,
+  trafficClasses        = Seq(("control", "", "fixed 1"), ("bulk", "onoff 4", "fixed 8")),
+  flowClasses           = (f) => if (f.vNetId == 0) "control" else "bulk",
+  packetStats           = true,
+  nocParams = NoCParams(
+    topology         = Mesh2D(4, 4),
+    channelParamGen  = (a, b) => UserChannelParams(Seq.fill(4) { UserVirtualChannelParams(4) }),
+    routerParams     = (i) => UserRouterParams(
+      vcAllocator = (vP) => (p) => new PrioritizingSingleVCAllocator(vP)(p)),
+    ingresses        = (0 until 32).map { i => UserIngressParams(i % 16) },
+    egresses         = (0 until 16).map { i => UserEgressParams(i) },
+    flows            = Seq.tabulate(32, 16) { (s, d) => FlowParams(s, d, s / 16) }.flatten,
+    routingRelation  = NonblockingVirtualSubnetworksRouting(Mesh2DEscapeRouting(), 2, 1)
+  )
+))
+// Oversubscribes egress 5, so the watchdog fails the run
+class EvalTestConfig25 extends EvalTestMeshConfig(NoCEvalParams(
+  pattern               = "hotspot 0.5 1.0 5",
+  watchdogCycles        = 100
+))
+// Resumes the checkpoint of EvalTestConfig22 in a fresh simulator
+class EvalTestConfig26 extends EvalTestMeshConfig(NoCEvalParams(
+  requiredMedianLatency = 20,
+  requiredMaxLatency    = 150,
+  pattern               = "uniform 0.02",
+  batchedDPI            = true,
+  checkpointRestore     = EvalTestCheckpoint.path
+))
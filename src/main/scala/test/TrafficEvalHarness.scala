@@ -16,6 +16,24 @@ import constellation.router.{HasRouterCtrlConsts}
 
 import scala.collection.immutable.ListMap
 
+class TrafficEvalIngressIO extends Bundle {
+  val ready = Input(Bool())
+  val valid = Output(Bool())
+  val head = Output(Bool())
+  val tail = Output(Bool())
+  val egress_id = Output(UInt(64.W))
+  val unique_id = Output(UInt(64.W))
+}
+
+class TrafficEvalEgressIO extends Bundle {
+  val ready = Output(Bool())
+  val valid = Input(Bool())
+  val head = Input(Bool())
+  val tail = Input(Bool())
+  val ingress_id = Input(UInt(64.W))
+  val unique_id = Input(UInt(64.W))
+}
+
 class TrafficEvalIngress(ingress_id: Int, config_str: String) extends BlackBox(Map(
   "INGRESS_ID" -> IntParam(ingress_id),
   "CONFIG_STR" -> config_str
@@ -25,20 +43,14 @@ class TrafficEvalIngress(ingress_id: Int, config_str: String) extends BlackBox(M
     val clock = Input(Clock())
     val reset = Input(Reset())
     val current_cycle = Input(UInt(64.W))
-    val flit_out = new Bundle {
-      val ready = Input(Bool())
-      val valid = Output(Bool())
-      val head = Output(Bool())
-      val tail = Output(Bool())
-      val egress_id = Output(UInt(64.W))
-      val unique_id = Output(UInt(64.W))
-    }
+    val flit_out = new TrafficEvalIngressIO
   })
   addResource("/csrc/netrace/netrace.h")
   addResource("/csrc/netrace/netrace.c")
   addResource("/vsrc/TrafficEval.v")
   addResource("/csrc/TrafficEval.cpp")
   addResource("/csrc/TrafficEval.h")
+  addResource("/csrc/TraceBinary.h")
 }
 
 class TrafficEvalEgress(egress_id: Int, config_str: String) extends BlackBox(Map(
@@ -50,13 +62,46 @@ class TrafficEvalEgress(egress_id: Int, config_str: String) extends BlackBox(Map
     val clock = Input(Clock())
     val reset = Input(Reset())
     val current_cycle = Input(UInt(64.W))
+    val flit_in = new TrafficEvalEgressIO
+    val success = Output(Bool())
+    val fatal = Output(Bool())
+  })
+  addResource("/csrc/netrace/netrace.h")
+  addResource("/csrc/netrace/netrace.c")
+  addResource("/vsrc/TrafficEval.v")
+  addResource("/csrc/TrafficEval.cpp")
+  addResource("/csrc/TrafficEval.h")
+  addResource("/csrc/TraceBinary.h")
+}
+
+// Services all ingresses and egresses with one DPI call per cycle. With
+// fastForward, keeps its own cycle count, which skips idle cycles.
+class TrafficEvalBatched(nIngresses: Int, nEgresses: Int, config_str: String, fastForward: Boolean) extends BlackBox(Map(
+  "NUM_INGRESSES" -> IntParam(nIngresses),
+  "NUM_EGRESSES" -> IntParam(nEgresses),
+  "CONFIG_STR" -> config_str,
+  "FAST_FORWARD" -> IntParam(if (fastForward) 1 else 0)
+))
+    with HasBlackBoxResource {
+  val io = IO(new Bundle {
+    val clock = Input(Clock())
+    val reset = Input(Reset())
+    val current_cycle = Input(UInt(64.W))
+    val flit_out = new Bundle {
+      val ready = Input(UInt(nIngresses.W))
+      val valid = Output(UInt(nIngresses.W))
+      val head = Output(UInt(nIngresses.W))
+      val tail = Output(UInt(nIngresses.W))
+      val egress_id = Output(UInt((64 * nIngresses).W))
+      val unique_id = Output(UInt((64 * nIngresses).W))
+    }
     val flit_in = new Bundle {
-      val ready = Output(Bool())
-      val valid = Input(Bool())
-      val head = Input(Bool())
-      val tail = Input(Bool())
-      val ingress_id = Input(UInt(64.W))
-      val unique_id = Input(UInt(64.W))
+      val ready = Output(UInt(nEgresses.W))
+      val valid = Input(UInt(nEgresses.W))
+      val head = Input(UInt(nEgresses.W))
+      val tail = Input(UInt(nEgresses.W))
+      val ingress_id = Input(UInt((64 * nEgresses).W))
+      val unique_id = Input(UInt((64 * nEgresses).W))
     }
     val success = Output(Bool())
     val fatal = Output(Bool())
@@ -66,6 +111,35 @@ class TrafficEvalEgress(egress_id: Int, config_str: String) extends BlackBox(Map
   addResource("/vsrc/TrafficEval.v")
   addResource("/csrc/TrafficEval.cpp")
   addResource("/csrc/TrafficEval.h")
+  addResource("/csrc/TraceBinary.h")
+}
+
+// Reports the routers' debug counters with one DPI call per cycle.
+// Counters are packed 16 bits each, in the order of the links of
+// layout_str.
+class TrafficEvalStats(nLinks: Int, nInputs: Int, nVCs: Int, config_str: String, layout_str: String) extends BlackBox(Map(
+  "NUM_LINKS" -> IntParam(nLinks),
+  "NUM_INPUTS" -> IntParam(nInputs),
+  "NUM_VCS" -> IntParam(nVCs),
+  "CONFIG_STR" -> config_str,
+  "LAYOUT_STR" -> layout_str
+))
+    with HasBlackBoxResource {
+  val io = IO(new Bundle {
+    val clock = Input(Clock())
+    val reset = Input(Reset())
+    val current_cycle = Input(UInt(64.W))
+    val link_flits = Input(UInt((16 * nLinks).W))
+    val va_stall = Input(UInt((16 * nInputs).W))
+    val sa_stall = Input(UInt((16 * nInputs).W))
+    val occupancy = Input(UInt((16 * nVCs).W))
+  })
+  addResource("/csrc/netrace/netrace.h")
+  addResource("/csrc/netrace/netrace.c")
+  addResource("/vsrc/TrafficEval.v")
+  addResource("/csrc/TrafficEval.cpp")
+  addResource("/csrc/TrafficEval.h")
+  addResource("/csrc/TraceBinary.h")
 }
 
 
@@ -75,6 +149,7 @@ case class NoCEvalParams(
   measurementCycles: Int = 20000,
   drainTimeoutCycles: Int = 100000,
   flitsPerPacket: Int = 4,
+  seed: Long = 0, // Seed of the synthetic traffic, for independent replications
   flows: (Int, Int) => Double = (a: Int, b: Int) => 0.0,
   requiredThroughput: Double = 0.0,
   requiredMedianLatency: Int = 99999,
@@ -82,13 +157,37 @@ case class NoCEvalParams(
   netraceEnable: Boolean = false,
   netraceRegion: Int = 2, // this is the PARSEC region-of-interest
   netraceTrace: String = "blackscholes_64c_simsmall.tra.bz2",
-  netraceIgnoreDependencies: Boolean = false
+  netraceIgnoreDependencies: Boolean = false,
+  netracePrefetch: Int = 4096, // Trace packets decoded ahead on a background thread, 0 to disable
+  pattern: String = "", // Built-in traffic pattern and rate, overrides flows, e.g. "transpose 0.3"
+  injectionProcess: String = "bernoulli", // e.g. "onoff 8", "pareto 1.5 8"
+  packetSize: String = "", // Defaults to fixed flitsPerPacket, e.g. "bimodal 1 9 0.5"
+  trafficClasses: Seq[(String, String, String)] = Nil, // Name, injection process and packet size of each class, "" for the defaults
+  flowClasses: FlowParams => String = (f: FlowParams) => "", // Traffic class of each flow, "" for the default class
+  sweep: String = "", // Load scale start, stop, and step, e.g. "0.2 2.0 0.2"
+  adaptive: String = "", // Batch cycles and relative CI width, e.g. "1000 0.05"
+  telemetry: String = "", // Window cycles and output file, e.g. "1000 telemetry.csv"
+  routerStats: String = "", // Window cycles and per-link heatmap file, e.g. "1000 heatmap.log"
+  resultsFile: String = "", // Path to write the results to as JSON
+  packetStats: Boolean = false, // Report per-packet latency, split into queueing and network time
+  requestResponse: String = "", // Closed-loop window, reply flits and service latency, e.g. "4 4 10"
+  sourceQueue: String = "", // Packets queued per ingress and full-queue policy, e.g. "16 drop" or "16 throttle"
+  watchdogCycles: Int = 0, // Abort once no progress is made for this many cycles, 0 to disable
+  checkpointSave: String = "", // Warmup cycle and file to save the traffic state to, e.g. "4000 warm.ckpt", and "idle" to defer it to an empty network
+  checkpointRestore: String = "", // File to restore the traffic state from, with the simulator's state, unless saved with an empty network
+  batchedDPI: Boolean = false, // One DPI call per cycle for all terminals
+  fastForward: Boolean = false // Skip idle cycles, requires batchedDPI
 ) {
+  require(!fastForward || batchedDPI, "fastForward requires batchedDPI")
+  require((checkpointSave.isEmpty && checkpointRestore.isEmpty) || batchedDPI, "checkpoints require batchedDPI")
+  require(!fastForward || routerStats.isEmpty, "routerStats windows count harness cycles, which fastForward skips")
+
   def toConfigStr = s"""# Default generated trafficeval config
 warmup                  $warmupCycles
 measurement             $measurementCycles
 drain                   $drainTimeoutCycles
 flits_per_packet        $flitsPerPacket
+seed                    $seed
 required_throughput     $requiredThroughput
 required_median_latency $requiredMedianLatency
 required_max_latency    $requiredMaxLatency
@@ -96,15 +195,40 @@ netrace_enable          $netraceEnable
 netrace_trace           $netraceTrace
 netrace_region          $netraceRegion
 netrace_ignore_dependencies $netraceIgnoreDependencies
-""" + nocParams.flows.map { f =>
-    s"flow             ${f.ingressId} ${f.egressId} ${flows(f.ingressId, f.egressId)}"
-  }.mkString("\n")
+netrace_prefetch        $netracePrefetch
+num_ingresses           ${nocParams.ingresses.size}
+num_egresses            ${nocParams.egresses.size}
+injection_process       $injectionProcess
+""" + (if (packetSize.nonEmpty) s"packet_size             $packetSize\n" else "") +
+  trafficClasses.map { case (name, process, size) =>
+    s"traffic_class           $name\n" +
+    (if (process.nonEmpty) s"class_process           $name $process\n" else "") +
+    (if (size.nonEmpty) s"class_packet_size       $name $size\n" else "")
+  }.mkString +
+  (if (sweep.nonEmpty) s"sweep                   $sweep\n" else "") +
+  (if (adaptive.nonEmpty) s"adaptive                $adaptive\n" else "") +
+  (if (telemetry.nonEmpty) s"telemetry               $telemetry\n" else "") +
+  (if (routerStats.nonEmpty) s"router_stats            $routerStats\n" else "") +
+  (if (resultsFile.nonEmpty) s"results_file            $resultsFile\n" else "") +
+  (if (packetStats) "packet_stats            true\n" else "") +
+  (if (requestResponse.nonEmpty) s"request_response        $requestResponse\n" else "") +
+  (if (sourceQueue.nonEmpty) s"source_queue            $sourceQueue\n" else "") +
+  (if (watchdogCycles > 0) s"watchdog                $watchdogCycles\n" else "") +
+  (if (checkpointSave.nonEmpty) s"checkpoint_save         $checkpointSave\n" else "") +
+  (if (checkpointRestore.nonEmpty) s"checkpoint_restore      $checkpointRestore\n" else "") +
+  (if (fastForward) s"fast_forward            true\n" else "") + (if (pattern.nonEmpty) {
+    s"pattern                 $pattern"
+  } else {
+    nocParams.flows.map { f =>
+      s"flow             ${f.ingressId} ${f.egressId} ${flows(f.ingressId, f.egressId)} ${flowClasses(f)}".trim
+    }.mkString("\n")
+  })
 }
 
 case object NoCEvalKey extends Field[NoCEvalParams](NoCEvalParams())
 
 class EvalHarness(implicit val p: Parameters) extends Module with HasSuccessIO {
-  val lazyNoC = LazyModule(new NoC(p(NoCEvalKey).nocParams))
+  val lazyNoC = LazyModule(new NoC(p(NoCEvalKey).nocParams.copy(hasDebug = p(NoCEvalKey).routerStats.nonEmpty)))
   val noc = Module(lazyNoC.module)
   noc.io.router_clocks.foreach(_.clock := clock)
   noc.io.router_clocks.foreach(_.reset := reset)
@@ -122,38 +246,103 @@ class EvalHarness(implicit val p: Parameters) extends Module with HasSuccessIO {
   val configStr = p(NoCEvalKey).toConfigStr
   ElaborationArtefacts.add("noceval.cfg", configStr)
 
-  noc.io.ingress.zipWithIndex.map { case (in,i) =>
-    val ingress = Module(new TrafficEvalIngress(i, configStr))
-    ingress.io.clock := clock
-    ingress.io.reset := reset
-    ingress.io.current_cycle := cycle
+  val nIngresses = noc.io.ingress.size
+  val nEgresses = noc.io.egress.size
 
+  // Per-terminal traffic eval ports, either from per-terminal blackboxes
+  // or sliced out of the batched blackbox
+  val (flitOuts, flitIns) = if (p(NoCEvalKey).batchedDPI) {
+    val batched = Module(new TrafficEvalBatched(nIngresses, nEgresses, configStr, p(NoCEvalKey).fastForward))
+    batched.io.clock := clock
+    batched.io.reset := reset
+    batched.io.current_cycle := cycle
+
+    val flitOuts = Seq.fill(nIngresses) { Wire(new TrafficEvalIngressIO) }
+    batched.io.flit_out.ready := VecInit(flitOuts.map(_.ready)).asUInt
+    flitOuts.zipWithIndex.foreach { case (f,i) =>
+      f.valid := batched.io.flit_out.valid(i)
+      f.head := batched.io.flit_out.head(i)
+      f.tail := batched.io.flit_out.tail(i)
+      f.egress_id := batched.io.flit_out.egress_id(64*i+63,64*i)
+      f.unique_id := batched.io.flit_out.unique_id(64*i+63,64*i)
+    }
+
+    val flitIns = Seq.fill(nEgresses) { Wire(new TrafficEvalEgressIO) }
+    flitIns.zipWithIndex.foreach { case (f,i) => f.ready := batched.io.flit_in.ready(i) }
+    batched.io.flit_in.valid := VecInit(flitIns.map(_.valid)).asUInt
+    batched.io.flit_in.head := VecInit(flitIns.map(_.head)).asUInt
+    batched.io.flit_in.tail := VecInit(flitIns.map(_.tail)).asUInt
+    batched.io.flit_in.ingress_id := Cat(flitIns.map(_.ingress_id).reverse)
+    batched.io.flit_in.unique_id := Cat(flitIns.map(_.unique_id).reverse)
+
+    when (batched.io.success) { io.success := true.B }
+    assert(!batched.io.fatal)
+    (flitOuts, flitIns)
+  } else {
+    val flitOuts = Seq.tabulate(nIngresses) { i =>
+      val ingress = Module(new TrafficEvalIngress(i, configStr))
+      ingress.io.clock := clock
+      ingress.io.reset := reset
+      ingress.io.current_cycle := cycle
+      ingress.io.flit_out
+    }
+    val flitIns = Seq.tabulate(nEgresses) { i =>
+      val egress = Module(new TrafficEvalEgress(i, configStr))
+      egress.io.clock := clock
+      egress.io.reset := reset
+      egress.io.current_cycle := cycle
+
+      when (egress.io.success) { io.success := true.B }
+      assert(!egress.io.fatal)
+      egress.io.flit_in
+    }
+    (flitOuts, flitIns)
+  }
+
+  (noc.io.ingress zip flitOuts).map { case (in,flit_out) =>
     // This queue handles the delayed response from the ingress unit
     // and restores the decoupled handshake
     val flit_q = Module(new Queue(in.flit.bits.cloneType, 1, flow=true, pipe=true))
-    ingress.io.flit_out.ready := flit_q.io.count === 0.U && in.flit.ready
-    flit_q.io.enq.valid := ingress.io.flit_out.valid
-    flit_q.io.enq.bits.head := ingress.io.flit_out.head
-    flit_q.io.enq.bits.tail := ingress.io.flit_out.tail
-    flit_q.io.enq.bits.egress_id := ingress.io.flit_out.egress_id
-    flit_q.io.enq.bits.payload := ingress.io.flit_out.unique_id
+    flit_out.ready := flit_q.io.count === 0.U && in.flit.ready
+    flit_q.io.enq.valid := flit_out.valid
+    flit_q.io.enq.bits.head := flit_out.head
+    flit_q.io.enq.bits.tail := flit_out.tail
+    flit_q.io.enq.bits.egress_id := flit_out.egress_id
+    flit_q.io.enq.bits.payload := flit_out.unique_id
 
     in.flit <> flit_q.io.deq
   }
-  noc.io.egress.zipWithIndex.map { case (out,i) =>
-    val egress = Module(new TrafficEvalEgress(i, configStr))
-    egress.io.clock := clock
-    egress.io.reset := reset
-    egress.io.current_cycle := cycle
-    out.flit.ready := egress.io.flit_in.ready
-    egress.io.flit_in.valid := out.flit.valid
-    egress.io.flit_in.head := out.flit.bits.head
-    egress.io.flit_in.tail := out.flit.bits.tail
-    egress.io.flit_in.ingress_id := out.flit.bits.ingress_id
-    egress.io.flit_in.unique_id := out.flit.bits.payload
-
-    when (egress.io.success) { io.success := true.B }
-    assert(!egress.io.fatal)
+  (noc.io.egress zip flitIns).map { case (out,flit_in) =>
+    out.flit.ready := flit_in.ready
+    flit_in.valid := out.flit.valid
+    flit_in.head := out.flit.bits.head
+    flit_in.tail := out.flit.bits.tail
+    flit_in.ingress_id := out.flit.bits.ingress_id
+    flit_in.unique_id := out.flit.bits.payload
+  }
+
+  if (p(NoCEvalKey).routerStats.nonEmpty) {
+    // Links in the order of the routers' debug counters, the input ports of
+    // each router followed by the egress ports, named as in the noc.adjlist
+    val routers = lazyNoC.routers
+    val inputs = routers.flatMap { r =>
+      r.inParams.map { i => (s"${i.srcId}", s"${r.nodeId}", i.nVirtualChannels) } ++
+      r.ingressParams.map { i => (s"i${i.ingressId}", s"${r.nodeId}", 1) }
+    }
+    val egresses = routers.flatMap { r => r.egressParams.map { e => (s"${r.nodeId}", s"e${e.egressId}", 0) } }
+    val layout = (inputs ++ egresses).map { case (src, dst, vcs) => s"$src $dst $vcs" }.mkString(" ")
+
+    def pack(counters: Seq[UInt]) = Cat(counters.map(_.pad(16)).reverse)
+    val debug = noc.io.router_debug
+    val stats = Module(new TrafficEvalStats(inputs.size + egresses.size, inputs.size, inputs.map(_._3).sum,
+      configStr, layout))
+    stats.io.clock := clock
+    stats.io.reset := reset
+    stats.io.current_cycle := cycle
+    stats.io.link_flits := pack(debug.flatMap(_.in_flits) ++ debug.flatMap(_.egress_flits))
+    stats.io.va_stall := pack(debug.flatMap(_.va_stall))
+    stats.io.sa_stall := pack(debug.flatMap(_.sa_stall))
+    stats.io.occupancy := pack(debug.flatMap(_.occupancy.flatten))
   }
 
   ElaborationArtefacts.add("plusArgs", PlusArgArtefacts.serialize_cHeader)
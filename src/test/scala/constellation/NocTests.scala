@@ -30,26 +30,35 @@ class EvalNoCChiselTester(implicit val p: Parameters) extends Module {
 abstract class BaseNoCTest(
   gen: Parameters => Module,
   configs: Seq[Config],
-  extraVerilatorFlags: Seq[String] = Nil) extends AnyFlatSpec with ChiselScalatestTester {
+  extraVerilatorFlags: Seq[String] = Nil,
+  expectAssertFail: Boolean = false) extends AnyFlatSpec with ChiselScalatestTester {
   behavior of "NoC"
 
+  def runConfig(config: Config): Unit = {
+    implicit val p: Parameters = config
+    val tester = test(gen(p))
+      .withAnnotations(Seq(
+        SimulatorDebugAnnotation,
+        VerilatorBackendAnnotation,
+        VerilatorFlags(extraVerilatorFlags),
+        VerilatorLinkFlags(Seq(
+          "-Wl,--allow-multiple-definition",
+          "-fcommon")),
+        VerilatorCFlags(Seq(
+          "-DNO_VPI",
+          "-fcommon",
+          "-fpermissive"))
+      ))
+    if (expectAssertFail) {
+      tester.runUntilAssertFail(timeout = 1000 * 1000)
+    } else {
+      tester.runUntilStop(timeout = 1000 * 1000)
+    }
+  }
+
   configs.foreach { config =>
-    it should s"pass test with config ${config.getClass.getName}" in {
-      implicit val p: Parameters = config
-      test(gen(p))
-        .withAnnotations(Seq(
-          SimulatorDebugAnnotation,
-          VerilatorBackendAnnotation,
-          VerilatorFlags(extraVerilatorFlags),
-          VerilatorLinkFlags(Seq(
-            "-Wl,--allow-multiple-definition",
-            "-fcommon")),
-          VerilatorCFlags(Seq(
-            "-DNO_VPI",
-            "-fcommon",
-            "-fpermissive"))
-        ))
-        .runUntilStop(timeout = 1000 * 1000)
+    it should s"${if (expectAssertFail) "fail" else "pass"} test with config ${config.getClass.getName}" in {
+      runConfig(config)
     }
   }
 }
@@ -58,6 +67,7 @@ abstract class NoCTest(configs: Seq[Config]) extends BaseNoCTest(p => new NoCChi
 abstract class TLNoCTest(configs: Seq[Config]) extends BaseNoCTest(p => new TLNoCChiselTester()(p), configs)
 abstract class AXI4NoCTest(configs: Seq[Config]) extends BaseNoCTest(p => new AXI4NoCChiselTester()(p), configs)
 abstract class EvalNoCTest(configs: Seq[Config]) extends BaseNoCTest(p => new EvalNoCChiselTester()(p), configs, Seq("../../../src/main/resources/csrc/netrace/netrace.o"))
+abstract class EvalNoCFailTest(configs: Seq[Config]) extends BaseNoCTest(p => new EvalNoCChiselTester()(p), configs, Seq("../../../src/main/resources/csrc/netrace/netrace.o"), true)
 
 
 // these tests allow you to run an infividual config
@@ -157,3 +167,59 @@ class NoCTestEval05 extends EvalNoCTest(Seq(new EvalTestConfig05))
 class NoCTestEval06 extends EvalNoCTest(Seq(new EvalTestConfig06))
 class NoCTestEval07 extends EvalNoCTest(Seq(new EvalTestConfig07))
 class NoCTestEval08 extends EvalNoCTest(Seq(new EvalTestConfig08))
+class NoCTestEval09 extends EvalNoCTest(Seq(new EvalTestConfig09))
+class NoCTestEval10 extends EvalNoCTest(Seq(new EvalTestConfig10))
+class NoCTestEval11 extends EvalNoCTest(Seq(new EvalTestConfig11))
+class NoCTestEval12 extends EvalNoCTest(Seq(new EvalTestConfig12))
+class NoCTestEval13 extends EvalNoCTest(Seq(new EvalTestConfig13))
+class NoCTestEval14 extends EvalNoCTest(Seq(new EvalTestConfig14))
+// Runs EvalTestConfig15 twice under one seed and once under another, and
+// checks its telemetry, results file and packet latencies
+class NoCTestEval15 extends EvalNoCTest(Nil) {
+  def readFile(path: String): String = {
+    val source = scala.io.Source.fromFile(path)
+    try source.mkString finally source.close()
+  }
+  def jsonNumber(json: String, key: String): Double = {
+    val m = ("\"" + key + "\": (-?[0-9.e+-]+)").r.findFirstMatchIn(json)
+    assert(m.isDefined, s"results have no $key")
+    m.get.group(1).toDouble
+  }
+  // Columns of each telemetry window
+  def telemetryRows(csv: String): Seq[Seq[Long]] = {
+    csv.linesIterator.drop(1).filter(_.nonEmpty).map(_.split(",").map(_.trim.toLong).toSeq).toSeq
+  }
+
+  it should "reproduce its outputs from its seed" in {
+    runConfig(new EvalTestConfig15(12345))
+    val telemetry = readFile(EvalTestOutputs.telemetry)
+    val results = readFile(EvalTestOutputs.results)
+    runConfig(new EvalTestConfig15(12345))
+    assert(readFile(EvalTestOutputs.telemetry) == telemetry, "the same seed gave different telemetry")
+    runConfig(new EvalTestConfig15(54321))
+    assert(readFile(EvalTestOutputs.telemetry) != telemetry, "another seed gave the same telemetry")
+
+    // Every window is recorded, and every flit injected is received
+    val rows = telemetryRows(telemetry)
+    assert(rows.nonEmpty && rows.map(_(0)) == rows.indices.map(_ * 1000L))
+    assert(rows.map(_(2)).sum > 0 && rows.map(_(2)).sum == rows.map(_(3)).sum)
+    assert(rows.last(4) == 0)
+
+    assert(results.contains("\"success\": true"))
+    assert(jsonNumber(results, "seed") == 12345)
+    // Packet latencies split into queueing and network time
+    val packetLatency = results.substring(results.indexOf("\"packet_latency\""))
+    assert(jsonNumber(packetLatency, "count") > 0)
+    val means = Seq("total", "queueing", "network").map { part =>
+      jsonNumber(packetLatency.substring(packetLatency.indexOf("\"" + part + "\"")), "mean")
+    }
+    assert(math.abs(means(0) - means(1) - means(2)) < 0.01)
+  }
+}
+class NoCTestEval19 extends EvalNoCTest(Seq(new EvalTestConfig19))
+class NoCTestEval20 extends EvalNoCTest(Seq(new EvalTestConfig20))
+class NoCTestEval21 extends EvalNoCTest(Seq(new EvalTestConfig21))
+class NoCTestEval22 extends EvalNoCTest(Seq(new EvalTestConfig22, new EvalTestConfig26))
+class NoCTestEval23 extends EvalNoCTest(Seq(new EvalTestConfig23))
+class NoCTestEval24 extends EvalNoCTest(Seq(new EvalTestConfig24))
+class NoCTestEval25 extends EvalNoCFailTest(Seq(new EvalTestConfig25))